@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Throughput benchmark matrix.
+
+Sweeps window size x (loss, delay) x file size x congestion controller, runs
+sender -> rdt_netem -> receiver on loopback for every point, repeats each point
+several times and writes machine-readable results:
+
+  <out>_runs.csv     one row per run (completion time, goodput, retransmissions, ok)
+  <out>_summary.csv  one row per point: mean / p50 / p99 completion time and goodput
+
+Only the standard library is needed. Build sender, receiver and rdt_netem
+first (see README 2.1) and point --bin-dir at them.
+
+Usage:
+  python bench_matrix.py [--bin-dir=.] [--wnd=16,8,4,2] [--cond=0/0,1/2,3/5,5/10]
+                         [--size=1M] [--cc=reno] [--reps=5] [--seed=1] [--out=bench]
+                         [--port=9300] [--timeout=300] [--sender-args="..."]
+
+--cond is a list of loss%/delay_ms pairs applied to the client->server
+direction (as Router.exe does); --size accepts K/M/G suffixes.
+"""
+
+import csv
+import filecmp
+import os
+import re
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+EXE = ".exe" if os.name == "nt" else ""
+
+
+def parse_args(argv):
+    opts = {
+        "bin-dir": ".", "wnd": "16,8,4,2", "cond": "0/0,1/2,3/5,5/10", "size": "1M",
+        "cc": "reno", "reps": "5", "seed": "1", "out": "bench", "port": "9300",
+        "timeout": "300", "sender-args": "",
+    }
+    for a in argv:
+        m = re.match(r"--([a-z-]+)=(.*)$", a)
+        if not m or m.group(1) not in opts:
+            print(__doc__)
+            sys.exit(1)
+        opts[m.group(1)] = m.group(2)
+    return opts
+
+
+def parse_size(s):
+    m = re.match(r"^(\d+)([KMG]?)$", s.strip().upper())
+    if not m:
+        raise ValueError(f"bad size: {s}")
+    return int(m.group(1)) * {"": 1, "K": 1 << 10, "M": 1 << 20, "G": 1 << 30}[m.group(2)]
+
+
+def percentile(values, p):
+    """Nearest-rank percentile (p in 0..100)."""
+    v = sorted(values)
+    if not v:
+        return float("nan")
+    k = max(0, min(len(v) - 1, int(-(-p * len(v) // 100)) - 1))
+    return v[k]
+
+
+def stop(proc, sig=signal.SIGINT):
+    if proc.poll() is None:
+        try:
+            proc.send_signal(sig)
+            proc.wait(timeout=5)
+        except (subprocess.TimeoutExpired, ValueError, OSError):
+            proc.kill()
+            proc.wait()
+
+
+def run_once(bins, work, infile, wnd, loss, delay, cc, seed, port, timeout, extra):
+    """One transfer through the relay. Returns a dict of results."""
+    netem_port, recv_port, send_port = port, port + 1, port + 2
+    outfile = os.path.join(work, "out.bin")
+    if os.path.exists(outfile):
+        os.remove(outfile)
+
+    netem_args = [bins["rdt_netem"], "127.0.0.1", str(netem_port), "127.0.0.1", str(recv_port), f"--seed={seed}"]
+    if loss > 0:
+        netem_args.append(f"--loss={loss / 100.0}")
+    if delay > 0:
+        netem_args.append(f"--delay={delay}")
+
+    logs = {n: open(os.path.join(work, n + ".log"), "w") for n in ("netem", "receiver", "sender")}
+    netem = subprocess.Popen(netem_args, stdout=logs["netem"], stderr=subprocess.STDOUT, cwd=work)
+    recv = subprocess.Popen([bins["receiver"], "127.0.0.1", str(recv_port), outfile, str(wnd)],
+                            stdout=logs["receiver"], stderr=subprocess.STDOUT, cwd=work)
+    time.sleep(0.2)
+
+    t0 = time.time()
+    send = subprocess.Popen([bins["sender"], "127.0.0.1", str(send_port), "127.0.0.1", str(netem_port),
+                             infile, str(wnd), f"--cc={cc}"] + extra,
+                            stdout=logs["sender"], stderr=subprocess.STDOUT, cwd=work)
+    try:
+        rc = send.wait(timeout=timeout)
+    except subprocess.TimeoutExpired:
+        send.kill()
+        send.wait()
+        rc = -1
+    wall = time.time() - t0
+    try:
+        recv.wait(timeout=10)
+    except subprocess.TimeoutExpired:
+        pass
+    stop(recv, signal.SIGTERM)
+    stop(netem)
+    for f in logs.values():
+        f.close()
+
+    with open(os.path.join(work, "sender.log"), errors="replace") as f:
+        slog = f.read()
+    res = {"ok": 0, "time_s": float("nan"), "goodput_mbps": float("nan"), "wall_s": round(wall, 3),
+           "fast_retx": "", "timeouts": "", "retx_segs": ""}
+    m = re.search(r"Transfer done\. bytes=(\d+) time=([\d.]+) s", slog)
+    if m:
+        nbytes, sec = int(m.group(1)), float(m.group(2))
+        res["time_s"] = sec
+        res["goodput_mbps"] = nbytes / 1024.0 / 1024.0 / max(sec, 1e-9)
+    m = re.search(r"Loss recovery: (\d+) fast recoveries, (\d+) timeouts, (\d+) segments retransmitted", slog)
+    if m:
+        res["fast_retx"], res["timeouts"], res["retx_segs"] = m.groups()
+    if rc == 0 and os.path.exists(outfile) and filecmp.cmp(infile, outfile, shallow=False):
+        res["ok"] = 1
+    return res
+
+
+def main():
+    o = parse_args(sys.argv[1:])
+    bins = {n: os.path.abspath(os.path.join(o["bin-dir"], n + EXE)) for n in ("sender", "receiver", "rdt_netem")}
+    for n, p in bins.items():
+        if not os.path.exists(p):
+            sys.exit(f"missing {n}: {p} (build it first, see README 2.1)")
+
+    wnds = [int(w) for w in o["wnd"].split(",")]
+    conds = [tuple(float(x) for x in c.split("/")) for c in o["cond"].split(",")]
+    sizes = [parse_size(s) for s in o["size"].split(",")]
+    ccs = o["cc"].split(",")
+    reps, seed, port, timeout = int(o["reps"]), int(o["seed"]), int(o["port"]), float(o["timeout"])
+    extra = o["sender-args"].split()
+
+    work = tempfile.mkdtemp(prefix="rdt_bench_")
+    inputs = {}
+    for size in sizes:
+        path = os.path.join(work, f"in_{size}.bin")
+        with open(path, "wb") as f:
+            f.write(os.urandom(size))
+        inputs[size] = path
+
+    runs_path, summary_path = o["out"] + "_runs.csv", o["out"] + "_summary.csv"
+    run_fields = ["cc", "size", "wnd", "loss_pct", "delay_ms", "rep", "seed", "ok", "time_s", "goodput_mbps",
+                  "wall_s", "fast_retx", "timeouts", "retx_segs"]
+    sum_fields = ["cc", "size", "wnd", "loss_pct", "delay_ms", "runs", "ok",
+                  "time_mean_s", "time_p50_s", "time_p99_s", "goodput_mean_mbps", "goodput_p50_mbps",
+                  "goodput_p99_mbps"]
+
+    total = len(ccs) * len(sizes) * len(wnds) * len(conds) * reps
+    done = 0
+    with open(runs_path, "w", newline="") as rf, open(summary_path, "w", newline="") as sf:
+        rw = csv.DictWriter(rf, fieldnames=run_fields)
+        sw = csv.DictWriter(sf, fieldnames=sum_fields)
+        rw.writeheader()
+        sw.writeheader()
+        for cc in ccs:
+            for size in sizes:
+                for wnd in wnds:
+                    for loss, delay in conds:
+                        times, goodputs, ok = [], [], 0
+                        for rep in range(reps):
+                            s = seed + rep
+                            r = run_once(bins, work, inputs[size], wnd, loss, delay, cc, s, port, timeout, extra)
+                            done += 1
+                            row = {"cc": cc, "size": size, "wnd": wnd, "loss_pct": loss, "delay_ms": delay,
+                                   "rep": rep, "seed": s}
+                            row.update(r)
+                            rw.writerow(row)
+                            rf.flush()
+                            if r["ok"]:
+                                ok += 1
+                                times.append(r["time_s"])
+                                goodputs.append(r["goodput_mbps"])
+                            print(f"[{done}/{total}] cc={cc} size={size} wnd={wnd} loss={loss}% delay={delay}ms "
+                                  f"rep={rep}: {'ok' if r['ok'] else 'FAILED'} time={r['time_s']:.3f} s "
+                                  f"goodput={r['goodput_mbps']:.3f} MB/s", flush=True)
+
+                        # p99 of goodput is the low tail (the slow runs), as for time
+                        fmt = lambda x: round(x, 4)
+                        sw.writerow({
+                            "cc": cc, "size": size, "wnd": wnd, "loss_pct": loss, "delay_ms": delay,
+                            "runs": reps, "ok": ok,
+                            "time_mean_s": fmt(sum(times) / len(times)) if times else "",
+                            "time_p50_s": fmt(percentile(times, 50)) if times else "",
+                            "time_p99_s": fmt(percentile(times, 99)) if times else "",
+                            "goodput_mean_mbps": fmt(sum(goodputs) / len(goodputs)) if goodputs else "",
+                            "goodput_p50_mbps": fmt(percentile(goodputs, 50)) if goodputs else "",
+                            "goodput_p99_mbps": fmt(percentile(goodputs, 1)) if goodputs else "",
+                        })
+                        sf.flush()
+
+    shutil.rmtree(work, ignore_errors=True)
+    print(f"Saved: {runs_path}")
+    print(f"Saved: {summary_path}")
+
+
+if __name__ == "__main__":
+    main()
@@ -2,18 +2,74 @@
 # -*- coding: utf-8 -*-
 """
 CWND Curve Plotting Script
-Reads cwnd data from CSV file and generates a plot.
-Usage: python plot_cwnd.py [input_csv] [output_image]
+Reads cwnd events from the sender's binary trace (rdt_trace.bin, see
+rdt_trace.h) or from an old time_ms,cwnd CSV, and generates a plot.
+Usage: python plot_cwnd.py [input_trace] [output_image]
 """
 
 import sys
 import os
+import struct
 
-def plot_cwnd(input_file="cwnd_log.csv", output_file="cwnd_curve.png"):
+TRACE_MAGIC = b"RDTTRC1\0"
+TR_NAMES = ["tx", "rx", "ack", "sack", "retx", "cwnd", "rtt", "timeout"]
+TR_CWND = 5
+
+
+def read_trace(path):
     """
-    Read cwnd data from CSV and plot the curve.
-    
-    CSV format: time_ms,cwnd
+    Parse a binary trace. Returns (counts, rtt_hist, records) with records as
+    (t_us, ev, x, a, b) tuples, oldest first.
+    """
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != TRACE_MAGIC:
+        raise ValueError("not an RDT trace")
+    rec_size, nev, nrec, dropped = struct.unpack_from("<IIQQ", data, 8)
+    off = 8 + struct.calcsize("<IIQQ")
+    counts = struct.unpack_from(f"<{nev}Q", data, off)
+    off += 8 * nev
+    hist = struct.unpack_from("<128Q", data, off)
+    off += 8 * 128
+    records = []
+    for i in range(nrec):
+        t_us, ev, _, x, a, b = struct.unpack_from("<IBBHII", data, off + i * rec_size)
+        records.append((t_us, ev, x, a, b))
+    if dropped:
+        print(f"Note: {dropped} oldest records were overwritten in the ring")
+    return dict(zip(TR_NAMES, counts)), hist, records
+
+
+def read_cwnd(input_file):
+    """Returns (times_ms, cwnds) from a binary trace or a time_ms,cwnd CSV."""
+    with open(input_file, "rb") as f:
+        binary = f.read(8) == TRACE_MAGIC
+    times, cwnds = [], []
+    if binary:
+        counts, _, records = read_trace(input_file)
+        print("Trace counters: " + ", ".join(f"{k}={v}" for k, v in counts.items()))
+        for t_us, ev, x, a, b in records:
+            if ev == TR_CWND:
+                times.append(t_us / 1000.0)
+                cwnds.append(a)
+        return times, cwnds
+    with open(input_file, 'r') as f:
+        # Skip header line
+        header = f.readline()
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            parts = line.split(',')
+            if len(parts) >= 2:
+                times.append(float(parts[0]))
+                cwnds.append(int(parts[1]))
+    return times, cwnds
+
+
+def plot_cwnd(input_file="rdt_trace.bin", output_file="cwnd_curve.png"):
+    """
+    Read cwnd data from the trace and plot the curve.
     """
     try:
         import matplotlib
@@ -27,23 +83,8 @@ def plot_cwnd(input_file="cwnd_log.csv", output_file="cwnd_curve.png"):
         print(f"Error: Input file '{input_file}' not found.")
         return False
     
-    times = []
-    cwnds = []
-    
     try:
-        with open(input_file, 'r') as f:
-            # Skip header line
-            header = f.readline()
-            for line in f:
-                line = line.strip()
-                if not line:
-                    continue
-                parts = line.split(',')
-                if len(parts) >= 2:
-                    time_ms = float(parts[0])
-                    cwnd = int(parts[1])
-                    times.append(time_ms)
-                    cwnds.append(cwnd)
+        times, cwnds = read_cwnd(input_file)
     except Exception as e:
         print(f"Error reading file: {e}")
         return False
@@ -85,8 +126,8 @@ def plot_cwnd(input_file="cwnd_log.csv", output_file="cwnd_curve.png"):
     return True
 
 if __name__ == "__main__":
-    input_csv = sys.argv[1] if len(sys.argv) > 1 else "cwnd_log.csv"
+    input_trace = sys.argv[1] if len(sys.argv) > 1 else "rdt_trace.bin"
     output_img = sys.argv[2] if len(sys.argv) > 2 else "cwnd_curve.png"
     
-    success = plot_cwnd(input_csv, output_img)
+    success = plot_cwnd(input_trace, output_img)
     sys.exit(0 if success else 1)
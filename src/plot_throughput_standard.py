@@ -1,9 +1,13 @@
 # plot_throughput_standard.py
+# Usage: python plot_throughput_standard.py [bench_summary.csv] [cc] [size]
+# With a summary from bench_matrix.py the mean goodput of each (wnd, loss,
+# delay) point is plotted; without one, the hand-measured Router.exe table below.
+import sys
 import pandas as pd
 import matplotlib.pyplot as plt
 from io import StringIO
 
-# ===== Input table (tab-separated) =====
+# ===== Input table (tab-separated, Router.exe runs) =====
 raw = """吞吐\t16\t8\t4\t2
 0 0\t0.06\t0.062\t0.067\t0.046
 1 2\t0.04\t0.047\t0.045\t0.027
@@ -12,18 +16,31 @@ raw = """吞吐\t16\t8\t4\t2
 """
 
 # ===== Read data =====
-df = pd.read_csv(StringIO(raw), sep=r"\t", engine="python")
+if len(sys.argv) > 1:
+    # bench_matrix.py summary -> one column of mean goodput per window
+    bench = pd.read_csv(sys.argv[1])
+    if len(sys.argv) > 2:
+        bench = bench[bench["cc"] == sys.argv[2]]
+    if len(sys.argv) > 3:
+        bench = bench[bench["size"] == int(sys.argv[3])]
+    df = bench.pivot_table(index=["loss_pct", "delay_ms"], columns="wnd",
+                           values="goodput_mean_mbps", aggfunc="mean").reset_index()
+    wnd_cols = sorted([c for c in df.columns if c not in ("loss_pct", "delay_ms")], reverse=True)
+    df.columns = [str(c) for c in df.columns]
+    wnd_cols = [str(c) for c in wnd_cols]
+else:
+    df = pd.read_csv(StringIO(raw), sep=r"\t", engine="python")
 
-# First column: "loss delay" (e.g., "3 5")
-pairs = df.iloc[:, 0].astype(str).str.split(r"\s+", expand=True)
-df["loss_pct"] = pairs[0].astype(int)
-df["delay_ms"] = pairs[1].astype(int)
+    # First column: "loss delay" (e.g., "3 5")
+    pairs = df.iloc[:, 0].astype(str).str.split(r"\s+", expand=True)
+    df["loss_pct"] = pairs[0].astype(int)
+    df["delay_ms"] = pairs[1].astype(int)
 
-# X labels: "(loss%, delayms)"
-x_labels = [f"({l}%, {d}ms)" for l, d in zip(df["loss_pct"], df["delay_ms"])]
+    # Columns for fixed windows
+    wnd_cols = ["16", "8", "4", "2"]
 
-# Columns for fixed windows
-wnd_cols = ["16", "8", "4", "2"]
+# X labels: "(loss%, delayms)"
+x_labels = [f"({l:g}%, {d:g}ms)" for l, d in zip(df["loss_pct"], df["delay_ms"])]
 
 # ===== Plot style (report-like) =====
 plt.rcParams.update({
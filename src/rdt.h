@@ -1,27 +1,80 @@
 #pragma once
+
+#ifdef _WIN32
 #define _WINSOCK_DEPRECATED_NO_WARNINGS
 #ifndef NOMINMAX
 #define NOMINMAX
 #endif
-
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#if defined(__linux__)
+#define RDT_HAVE_MMSG 1   // sendmmsg/recvmmsg
+#include <endian.h>
+#define htonll(x) htobe64(x)
+#define ntohll(x) be64toh(x)
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define RDT_X86 1
+#endif
+
 #include <cstdint>
+#include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <string>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <memory>
 
-#pragma comment(lib, "ws2_32.lib")
+#ifndef _WIN32
+// ====== Minimal Winsock shim so the same sources build on POSIX ======
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR   (-1)
+#define MAKEWORD(a, b) ((unsigned short)(((a) & 0xFF) | (((b) & 0xFF) << 8)))
+struct WSADATA { int unused; };
+static inline int WSAStartup(unsigned short, WSADATA*) { return 0; }
+static inline int WSACleanup() { return 0; }
+static inline int WSAGetLastError() { return errno; }
+static inline int closesocket(SOCKET s) { return ::close(s); }
+#endif
 
 // ====== Tunables ======
-static constexpr int RDT_MSS               = 1000;   // payload max per segment
-static constexpr int RDT_SACK_BITS         = 64;     // SACK bitmap length
-static constexpr int RDT_MAX_PKT           = 1400;   // UDP payload cap (safe < 15000 of router)
-static constexpr int RDT_RTO_MS            = 300;    // retransmission timeout (data)
-static constexpr int RDT_HANDSHAKE_RTO_MS  = 300;    // SYN/FIN timeout
+static constexpr int RDT_MSS               = 1000;   // base segment payload: used until the path is probed, and with peers without OPT_MSS
+static constexpr int RDT_SACK_BLOCKS       = 16;     // max SACK blocks per ACK (bounds ACK size)
+static constexpr int RDT_MAX_OPT           = 256;    // max option bytes after the header (multiple of 4)
+static constexpr int RDT_MAX_WSCALE        = 14;     // window-scale shift limit (as TCP)
+static constexpr int RDT_MAX_WND           = (1 << 30) / RDT_MSS;  // segments of RDT_MSS; keeps a window < 2^31 bytes of seq space
+static constexpr int RDT_MAX_PKT           = 65507;  // largest UDP payload (IPv4); what is sent is negotiated and probed
+static constexpr int RDT_RTO_INIT_MS       = 300;    // RTO before the first RTT sample (data/SYN/FIN)
+static constexpr int RDT_RTO_MIN_MS        = 20;     // lower clamp of the adaptive RTO
+static constexpr int RDT_RTO_MAX_MS        = 2000;   // upper clamp (also caps exponential backoff)
 static constexpr int RDT_MAX_RETX          = 50;     // safety
+static constexpr int RDT_IDLE_MS           = RDT_MAX_RETX * RDT_RTO_MAX_MS;  // receiver: a connection silent this long is dropped (the sender gave up)
+static constexpr int RDT_DUPTHRESH         = 3;      // dupACKs / SACKed segments above a hole that mean loss
+static constexpr int RDT_BATCH             = 64;     // datagrams per batched send/recv call
+static constexpr int RDT_ACK_EVERY         = 2;      // receiver: ACK every N in-order segments
+static constexpr int RDT_DELACK_MS         = 5;      // receiver: delayed-ACK timer (< RDT_RTO_MIN_MS)
+static constexpr int RDT_PACE_QUANTUM_US   = 1000;   // pacer burst: this much time worth of data (poll is ms-granular)
+static constexpr int RDT_PACE_MIN_BURST    = 2;      // pacer burst floor, in segments
+static constexpr int RDT_DISK_POLL_US      = 1000;   // protocol thread polls its disk thread this often while waiting on it
+static constexpr int RDT_FEC_MAX_K         = 16;     // DATA segments covered by one parity segment, at most
 
 // ====== flags ======
 enum : uint16_t {
@@ -29,7 +82,9 @@ enum : uint16_t {
     F_ACK  = 0x0002,
     F_FIN  = 0x0004,
     F_DATA = 0x0008,
-    F_RST  = 0x0010
+    F_RST  = 0x0010,
+    F_PROBE = 0x0020,  // path MTU probe: padding payload, consumes no sequence space
+    F_FEC   = 0x0040   // XOR parity of the DATA segments from seq on (OPT_FEC), consumes no sequence space
 };
 
 #pragma pack(push, 1)
@@ -37,44 +92,352 @@ struct RdtHeader {
     uint32_t seq;        // byte-seq of first byte in this segment (or ISN for SYN)
     uint32_t ack;        // cumulative ACK: next expected byte
     uint16_t flags;      // SYN/ACK/FIN/DATA/RST
-    uint16_t wnd;        // fixed window size (segments)
+    uint16_t wnd;        // window (segments), >> the peer-negotiated wscale after SYN
     uint16_t len;        // payload length
-    uint16_t cksum;      // checksum over header+payload
-    uint64_t sack_mask;  // SACK bitmap for 64 segments after ack
+    uint16_t cksum;      // checksum over header+options+payload
+    uint16_t optlen;     // bytes of TLV options between header and payload (multiple of 4)
+    uint16_t conn;       // connection ID: picked by the sender, echoed on every packet
 };
 #pragma pack(pop)
 
+// largest segment payload: a datagram that still has room for every option
+static constexpr int RDT_MAX_MSS = RDT_MAX_PKT - (int)sizeof(RdtHeader) - RDT_MAX_OPT;
+
+// Segments of mss bytes a window may hold (keeps it < 2^31 bytes of seq space).
+static inline uint32_t max_wnd_for(int mss) {
+    return (uint32_t)(1 << 30) / (uint32_t)std::max(mss, RDT_MSS);
+}
+
+// ====== header options ======
+// Wire: kind(1) len(1) body, len counting kind and len; padded with OPT_NOP
+// to a multiple of 4. Unknown kinds are skipped by length.
+enum : uint8_t {
+    OPT_END     = 0,
+    OPT_NOP     = 1,
+    OPT_MSS     = 2,   // SYN, SYN|ACK only: largest segment payload the end takes (u16)
+    OPT_WSCALE  = 3,   // SYN, SYN|ACK only: shift applied to the sender's later wnd fields
+    OPT_SACK    = 5,   // n x {start, end} byte ranges (network order), like TCP
+    OPT_STRIPE  = 6,   // SYN only: the connection carries one stripe of a file
+    OPT_PMTU    = 7,   // ACK: payload size of the path MTU probe it answers (u16)
+    OPT_SESSION = 8,   // SYN only: the stream is a multi-file session of n files (u32)
+    OPT_COOKIE  = 9,   // SYN, SYN|ACK only: fast-open cookie (u64); empty in a SYN: a cookie request
+    OPT_FEC     = 10,  // SYN, SYN|ACK: parity understood (empty); F_FEC: lengths of the covered segments (n x u16)
+    OPT_FEC_ACK = 11   // ACK: segments rebuilt from parity and lost, segments that came twice, so far (2 x u32)
+};
+
+// ====== sequence space (serial-number arithmetic, RFC 1982) ======
+// seq/ack are 32-bit byte numbers that wrap; two of them compare by the
+// sign of their difference, valid while they are < 2^31 apart (the window
+// is capped far below that, see RDT_MAX_WND).
+static inline bool seq_lt(uint32_t a, uint32_t b)  { return (int32_t)(a - b) < 0; }
+static inline bool seq_leq(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+static inline bool seq_gt(uint32_t a, uint32_t b)  { return (int32_t)(a - b) > 0; }
+static inline bool seq_geq(uint32_t a, uint32_t b) { return (int32_t)(a - b) >= 0; }
+static inline uint32_t seq_max(uint32_t a, uint32_t b) { return seq_lt(a, b) ? b : a; }
+static inline uint32_t seq_min(uint32_t a, uint32_t b) { return seq_lt(a, b) ? a : b; }
+
+// [start, end) byte range received beyond the cumulative ACK
+struct SackBlock {
+    uint32_t start;
+    uint32_t end;
+};
+
+// Striped transfer: stripe idx of cnt carries the file bytes starting at
+// off; every stripe of one file has the same file id.
+struct StripeInfo {
+    uint32_t file = 0;
+    uint64_t off = 0;
+    uint8_t idx = 0;
+    uint8_t cnt = 0;   // 0: not striped
+};
+
+// Host-order view of the options a packet carries.
+struct RdtOptions {
+    int mss = -1;      // -1: not present (mss, pmtu, wscale)
+    int pmtu = -1;
+    int wscale = -1;
+    int nsack = 0;
+    SackBlock sack[RDT_SACK_BLOCKS];
+    StripeInfo stripe;
+    int64_t session = -1;   // file count of a session (-1: a single file)
+    int tfo = -1;           // OPT_COOKIE: -1 not present, 0 cookie request, 1 cookie below
+    uint64_t cookie = 0;
+    bool fec = false;       // OPT_FEC in a SYN / SYN|ACK
+    int fec_n = 0;          // OPT_FEC in a parity segment: the covered segments' lengths
+    uint16_t fec_len[RDT_FEC_MAX_K];
+    int64_t fec_rebuilt = -1;   // OPT_FEC_ACK (-1: not present)
+    uint32_t fec_dup = 0;       // OPT_FEC_ACK: DATA segments received twice (spurious retransmissions)
+};
+
+// Sorted, disjoint, non-touching byte ranges. The receiver keeps the data it
+// holds beyond the cumulative ACK in one; the sender's SACK scoreboard is
+// another. Holes are few compared to segments, so a flat vector is used and
+// every operation is O(log holes + ranges touched).
+class RangeSet {
+public:
+    bool empty() const { return r_.empty(); }
+    size_t size() const { return r_.size(); }
+    const SackBlock& operator[](size_t i) const { return r_[i]; }
+    void clear() { r_.clear(); }
+
+    // Index of the first range that ends at or after seq.
+    size_t lower(uint32_t seq) const {
+        size_t lo = 0, hi = r_.size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (seq_lt(r_[mid].end, seq)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    bool covers(uint32_t start, uint32_t end) const {
+        size_t i = lower(end);
+        return i < r_.size() && seq_leq(r_[i].start, start);
+    }
+
+    // Add [start, end). Sub-ranges not covered before are appended to fresh
+    // (if given). Returns the merged range that now holds [start, end).
+    SackBlock add(uint32_t start, uint32_t end, std::vector<SackBlock>* fresh = nullptr) {
+        if (seq_leq(end, start)) return {start, start};
+        size_t i = lower(start), j = i;
+        SackBlock m = {start, end};
+        uint32_t cur = start;
+        for (; j < r_.size() && seq_leq(r_[j].start, end); j++) {
+            if (fresh && seq_gt(r_[j].start, cur)) fresh->push_back({cur, r_[j].start});
+            cur = seq_max(cur, r_[j].end);
+            m.start = seq_min(m.start, r_[j].start);
+            m.end = seq_max(m.end, r_[j].end);
+        }
+        if (fresh && seq_lt(cur, end)) fresh->push_back({cur, end});
+        if (i == j) {
+            r_.insert(r_.begin() + (ptrdiff_t)i, m);
+        } else {
+            r_[i] = m;
+            r_.erase(r_.begin() + (ptrdiff_t)i + 1, r_.begin() + (ptrdiff_t)j);
+        }
+        return m;
+    }
+
+    // The cumulative point reached seq: ranges starting at or before it are
+    // consumed and seq is carried past them. Returns the new cumulative point.
+    uint32_t advance(uint32_t seq) {
+        size_t k = 0;
+        for (; k < r_.size() && seq_leq(r_[k].start, seq); k++) seq = seq_max(seq, r_[k].end);
+        r_.erase(r_.begin(), r_.begin() + (ptrdiff_t)k);
+        return seq;
+    }
+
+private:
+    std::vector<SackBlock> r_;
+};
+
+// ====== window scaling ======
+// Smallest shift that lets wnd segments fit the 16-bit wnd field.
+static inline int wscale_for(uint32_t wnd) {
+    int s = 0;
+    while (s < RDT_MAX_WSCALE && (wnd >> s) > 0xFFFF) s++;
+    return s;
+}
+
+static inline uint16_t wnd_field(uint32_t wnd, int shift) {
+    return (uint16_t)std::min<uint32_t>(wnd >> shift, 0xFFFF);
+}
+
+// ====== Virtual clock and network (rdt_sim.h) ======
+// With a VirtualNet installed, the clock, ISNs and the socket calls below
+// (wait_readable, send_pkt, flush_batch, recv_batch) go to it instead of the
+// OS, so the unchanged protocol code runs under a deterministic discrete-event
+// simulator. Not installed (every real program): one predictable branch.
+struct VirtualNet {
+    virtual ~VirtualNet() {}
+    virtual uint64_t now_us() = 0;
+    virtual uint32_t random() = 0;
+    virtual int wait(SOCKET s, int timeout_ms) = 0;
+    virtual int send(SOCKET s, const sockaddr_in& to, const uint8_t* head, size_t hlen,
+                     const uint8_t* payload, size_t len) = 0;
+    // one pending datagram into buf (at most cap bytes); -1 if none
+    virtual int recv(SOCKET s, uint8_t* buf, int cap, sockaddr_in& from) = 0;
+    bool quiet = false;   // drop LOG() output
+};
+
+// single-threaded programs only (the simulator)
+static inline VirtualNet*& virtual_net() {
+    static VirtualNet* v = nullptr;
+    return v;
+}
+
+// Initial sequence number: random over the whole 32-bit space, so wraparound
+// is exercised in normal operation rather than only after 4 GiB.
+static inline uint32_t rdt_isn() {
+    if (VirtualNet* v = virtual_net()) return v->random();
+    std::random_device rd;
+    return rd() ^ (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
 static inline uint64_t now_ms() {
+    if (VirtualNet* v = virtual_net()) return v->now_us() / 1000;
     using namespace std::chrono;
     return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
 }
 
+static inline uint64_t now_us() {
+    if (VirtualNet* v = virtual_net()) return v->now_us();
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// One line per call, written with a single stdio call so lines from
+// several worker threads never interleave. tag (may be null) prefixes it.
+static inline void vlog(const char* tag, const char* fmt, va_list ap) {
+    if (virtual_net() && virtual_net()->quiet) return;
+    char line[1024];
+    int n = std::snprintf(line, sizeof(line), "[%-10llu ms] %s%s", (unsigned long long)now_ms(),
+                          tag ? tag : "", tag && *tag ? " " : "");
+    n = std::max(0, std::min(n, (int)sizeof(line) - 2));
+    int m = std::vsnprintf(line + n, sizeof(line) - n - 1, fmt, ap);
+    n = std::min(n + std::max(0, m), (int)sizeof(line) - 2);
+    line[n++] = '\n';
+    line[n] = '\0';
+    std::fputs(line, stdout);
+}
+
 static inline void LOG(const char* fmt, ...) {
-    uint64_t t = now_ms();
-    std::printf("[%-10llu ms] ", (unsigned long long)t);
     va_list ap;
     va_start(ap, fmt);
-    std::vprintf(fmt, ap);
+    vlog(nullptr, fmt, ap);
     va_end(ap);
-    std::printf("\n");
 }
 
 // Internet checksum (16-bit one's complement)
-static inline uint16_t checksum16(const uint8_t* data, size_t len) {
-    uint32_t sum = 0;
-    size_t i = 0;
-    while (i + 1 < len) {
-        uint16_t word = (uint16_t(data[i]) << 8) | uint16_t(data[i + 1]);
-        sum += word;
-        if (sum & 0x10000) sum = (sum & 0xFFFF) + 1;
-        i += 2;
+// The one's complement sum is byte-order independent (RFC 1071), so data is
+// summed as native 32-bit words into a 64-bit accumulator (SIMD where
+// available), folded to 16 bits once, then swapped to the big-endian word
+// order the wire format has always used. No per-word carry branch.
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define RDT_LITTLE_ENDIAN 1
+#endif
+
+static inline uint32_t csum_fold(uint64_t a) {
+    a = (a & 0xFFFFFFFFull) + (a >> 32);
+    a = (a & 0xFFFFFFFFull) + (a >> 32);
+    a = (a & 0xFFFF) + (a >> 16);
+    a = (a & 0xFFFF) + (a >> 16);
+    a = (a & 0xFFFF) + (a >> 16);
+    return (uint32_t)a;
+}
+
+static inline uint64_t csum_scalar(uint64_t acc, const uint8_t* p, size_t n) {
+    while (n >= 32) {
+        uint64_t a, b, c, d;
+        std::memcpy(&a, p, 8);
+        std::memcpy(&b, p + 8, 8);
+        std::memcpy(&c, p + 16, 8);
+        std::memcpy(&d, p + 24, 8);
+        acc += (a & 0xFFFFFFFFull) + (a >> 32) + (b & 0xFFFFFFFFull) + (b >> 32)
+             + (c & 0xFFFFFFFFull) + (c >> 32) + (d & 0xFFFFFFFFull) + (d >> 32);
+        p += 32; n -= 32;
     }
-    if (i < len) { // odd byte
-        uint16_t word = uint16_t(data[i]) << 8;
-        sum += word;
-        if (sum & 0x10000) sum = (sum & 0xFFFF) + 1;
+    while (n >= 4) {
+        uint32_t w;
+        std::memcpy(&w, p, 4);
+        acc += w;
+        p += 4; n -= 4;
     }
-    return uint16_t(~sum & 0xFFFF);
+    if (n >= 2) {
+        uint16_t w;
+        std::memcpy(&w, p, 2);
+        acc += w;
+        p += 2; n -= 2;
+    }
+    if (n) { // odd byte: high half of a big-endian word
+#ifdef RDT_LITTLE_ENDIAN
+        acc += p[0];
+#else
+        acc += uint32_t(p[0]) << 8;
+#endif
+    }
+    return acc;
+}
+
+#ifdef RDT_X86
+// SSE2: zero-extend 32-bit lanes into 64-bit accumulators, 16 bytes per step
+static inline uint64_t csum_sse2(uint64_t acc, const uint8_t* p, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s0 = zero, s1 = zero;
+    while (n >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i*)p);
+        __m128i b = _mm_loadu_si128((const __m128i*)(p + 16));
+        s0 = _mm_add_epi64(s0, _mm_unpacklo_epi32(a, zero));
+        s1 = _mm_add_epi64(s1, _mm_unpackhi_epi32(a, zero));
+        s0 = _mm_add_epi64(s0, _mm_unpacklo_epi32(b, zero));
+        s1 = _mm_add_epi64(s1, _mm_unpackhi_epi32(b, zero));
+        p += 32; n -= 32;
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(s0, s1));
+    // a lane gains < 2^33 per step, far from overflow for any datagram
+    acc += csum_fold(lanes[0]) + (uint64_t)csum_fold(lanes[1]);
+    return csum_scalar(acc, p, n);
+}
+
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static inline uint64_t csum_avx2(uint64_t acc, const uint8_t* p, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s0 = zero, s1 = zero;
+    while (n >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)p);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p + 32));
+        s0 = _mm256_add_epi64(s0, _mm256_unpacklo_epi32(a, zero));
+        s1 = _mm256_add_epi64(s1, _mm256_unpackhi_epi32(a, zero));
+        s0 = _mm256_add_epi64(s0, _mm256_unpacklo_epi32(b, zero));
+        s1 = _mm256_add_epi64(s1, _mm256_unpackhi_epi32(b, zero));
+        p += 64; n -= 64;
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(s0, s1));
+    acc += (uint64_t)csum_fold(lanes[0]) + csum_fold(lanes[1]) + csum_fold(lanes[2]) + csum_fold(lanes[3]);
+    return csum_sse2(acc, p, n);
+}
+
+static inline bool cpu_has_avx2() {
+#if defined(__GNUC__)
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+#elif defined(__AVX2__)
+    return true;
+#else
+    return false;
+#endif
+}
+#endif
+
+// Native-order sum of data (not folded); dispatches to the widest engine.
+static inline uint64_t csum_native(const uint8_t* p, size_t n) {
+#ifdef RDT_X86
+    if (n >= 64 && cpu_has_avx2()) return csum_avx2(0, p, n);
+    if (n >= 32) return csum_sse2(0, p, n);
+#endif
+    return csum_scalar(0, p, n);
+}
+
+// checksum_add() folds data into a running sum so discontiguous pieces
+// (header, then payload) can be summed in place; every piece except the
+// last must have even length. Sums are 16-bit, big-endian word order.
+static inline uint32_t checksum_add(uint32_t sum, const uint8_t* data, size_t len) {
+    uint32_t s = csum_fold(csum_native(data, len));
+#ifdef RDT_LITTLE_ENDIAN
+    s = ((s & 0xFF) << 8) | (s >> 8);
+#endif
+    return csum_fold((uint64_t)sum + s);
+}
+
+static constexpr uint32_t RDT_NO_PSUM = 0xFFFFFFFFu;   // "payload sum not cached"
+
+static inline uint16_t checksum16(const uint8_t* data, size_t len) {
+    return uint16_t(~checksum_add(0, data, len) & 0xFFFF);
 }
 
 // host<->network conversions for header fields
@@ -85,7 +448,8 @@ static inline void hton_header(RdtHeader& h) {
     h.wnd       = htons(h.wnd);
     h.len       = htons(h.len);
     h.cksum     = htons(h.cksum);
-    h.sack_mask = htonll(h.sack_mask);
+    h.optlen    = htons(h.optlen);
+    h.conn      = htons(h.conn);
 }
 static inline void ntoh_header(RdtHeader& h) {
     h.seq       = ntohl(h.seq);
@@ -94,28 +458,301 @@ static inline void ntoh_header(RdtHeader& h) {
     h.wnd       = ntohs(h.wnd);
     h.len       = ntohs(h.len);
     h.cksum     = ntohs(h.cksum);
-    h.sack_mask = ntohll(h.sack_mask);
+    h.optlen    = ntohs(h.optlen);
+    h.conn      = ntohs(h.conn);
+}
+
+// Encode opt into out (RDT_MAX_OPT bytes); returns the padded length.
+static inline uint16_t encode_options(const RdtOptions& opt, uint8_t* out) {
+    size_t n = 0;
+    if (opt.mss >= 0) {
+        out[n++] = OPT_MSS;
+        out[n++] = 4;
+        out[n++] = uint8_t(opt.mss >> 8);
+        out[n++] = uint8_t(opt.mss);
+    }
+    if (opt.pmtu >= 0) {
+        out[n++] = OPT_PMTU;
+        out[n++] = 4;
+        out[n++] = uint8_t(opt.pmtu >> 8);
+        out[n++] = uint8_t(opt.pmtu);
+    }
+    if (opt.wscale >= 0) {
+        out[n++] = OPT_WSCALE;
+        out[n++] = 3;
+        out[n++] = (uint8_t)opt.wscale;
+    }
+    if (opt.nsack > 0) {
+        out[n++] = OPT_SACK;
+        out[n++] = uint8_t(2 + 8 * opt.nsack);
+        for (int i = 0; i < opt.nsack; i++) {
+            uint32_t be[2] = {htonl(opt.sack[i].start), htonl(opt.sack[i].end)};
+            std::memcpy(out + n, be, 8);
+            n += 8;
+        }
+    }
+    if (opt.stripe.cnt > 0) {
+        // file(4) off(8, high word first) idx(1) cnt(1)
+        out[n++] = OPT_STRIPE;
+        out[n++] = 16;
+        uint32_t be[3] = {htonl(opt.stripe.file), htonl(uint32_t(opt.stripe.off >> 32)),
+                          htonl(uint32_t(opt.stripe.off))};
+        std::memcpy(out + n, be, 12);
+        n += 12;
+        out[n++] = opt.stripe.idx;
+        out[n++] = opt.stripe.cnt;
+    }
+    if (opt.session >= 0) {
+        out[n++] = OPT_SESSION;
+        out[n++] = 6;
+        uint32_t be = htonl((uint32_t)opt.session);
+        std::memcpy(out + n, &be, 4);
+        n += 4;
+    }
+    if (opt.tfo >= 0) {
+        out[n++] = OPT_COOKIE;
+        out[n++] = opt.tfo == 1 ? 10 : 2;
+        for (int i = 7; opt.tfo == 1 && i >= 0; i--) out[n++] = uint8_t(opt.cookie >> (8 * i));
+    }
+    if (opt.fec || opt.fec_n > 0) {
+        out[n++] = OPT_FEC;
+        out[n++] = uint8_t(2 + 2 * opt.fec_n);
+        for (int i = 0; i < opt.fec_n; i++) {
+            out[n++] = uint8_t(opt.fec_len[i] >> 8);
+            out[n++] = uint8_t(opt.fec_len[i]);
+        }
+    }
+    if (opt.fec_rebuilt >= 0) {
+        out[n++] = OPT_FEC_ACK;
+        out[n++] = 10;
+        uint32_t be[2] = {htonl((uint32_t)opt.fec_rebuilt), htonl(opt.fec_dup)};
+        std::memcpy(out + n, be, 8);
+        n += 8;
+    }
+    while (n & 3) out[n++] = OPT_NOP;
+    return (uint16_t)n;
+}
+
+// Decode an option area; false if it is malformed.
+static inline bool decode_options(const uint8_t* p, size_t n, RdtOptions& opt) {
+    opt.mss = -1;
+    opt.pmtu = -1;
+    opt.wscale = -1;
+    opt.nsack = 0;
+    opt.stripe = StripeInfo();
+    opt.session = -1;
+    opt.tfo = -1;
+    opt.cookie = 0;
+    opt.fec = false;
+    opt.fec_n = 0;
+    opt.fec_rebuilt = -1;
+    opt.fec_dup = 0;
+    size_t i = 0;
+    while (i < n) {
+        uint8_t kind = p[i];
+        if (kind == OPT_END) break;
+        if (kind == OPT_NOP) { i++; continue; }
+        if (i + 2 > n || p[i + 1] < 2 || i + p[i + 1] > n) return false;
+        size_t len = p[i + 1];
+        if ((kind == OPT_MSS || kind == OPT_PMTU) && len == 4) {
+            int v = (p[i + 2] << 8) | p[i + 3];
+            (kind == OPT_MSS ? opt.mss : opt.pmtu) = v;
+        } else if (kind == OPT_WSCALE && len == 3) {
+            opt.wscale = std::min<int>(p[i + 2], RDT_MAX_WSCALE);
+        } else if (kind == OPT_SACK) {
+            int nb = (int)std::min<size_t>((len - 2) / 8, RDT_SACK_BLOCKS);
+            for (int b = 0; b < nb; b++) {
+                uint32_t be[2];
+                std::memcpy(be, p + i + 2 + 8 * b, 8);
+                opt.sack[b].start = ntohl(be[0]);
+                opt.sack[b].end = ntohl(be[1]);
+            }
+            opt.nsack = nb;
+        } else if (kind == OPT_STRIPE && len == 16) {
+            uint32_t be[3];
+            std::memcpy(be, p + i + 2, 12);
+            opt.stripe.file = ntohl(be[0]);
+            opt.stripe.off = ((uint64_t)ntohl(be[1]) << 32) | ntohl(be[2]);
+            opt.stripe.idx = p[i + 14];
+            opt.stripe.cnt = p[i + 15];
+        } else if (kind == OPT_SESSION && len == 6) {
+            uint32_t be;
+            std::memcpy(&be, p + i + 2, 4);
+            opt.session = ntohl(be);
+        } else if (kind == OPT_COOKIE && (len == 2 || len == 10)) {
+            opt.tfo = len == 10 ? 1 : 0;
+            opt.cookie = 0;
+            for (size_t b = 0; b + 2 < len; b++) opt.cookie = (opt.cookie << 8) | p[i + 2 + b];
+        } else if (kind == OPT_FEC && len % 2 == 0 && len <= 2 + 2 * RDT_FEC_MAX_K) {
+            opt.fec = true;
+            opt.fec_n = (int)(len - 2) / 2;
+            for (int b = 0; b < opt.fec_n; b++) opt.fec_len[b] = uint16_t((p[i + 2 + 2 * b] << 8) | p[i + 3 + 2 * b]);
+        } else if (kind == OPT_FEC_ACK && (len == 6 || len == 10)) {
+            uint32_t be[2] = {0, 0};
+            std::memcpy(be, p + i + 2, len - 2);
+            opt.fec_rebuilt = ntohl(be[0]);
+            opt.fec_dup = ntohl(be[1]);
+        }
+        i += len;
+    }
+    return true;
+}
+
+// ====== multi-file session framing ======
+// A session (OPT_SESSION) carries many files over one connection: its byte
+// stream is a manifest, then every file's contents back to back in manifest
+// order, so a file ends where the next begins and needs no per-file header
+// in the data. Manifest, all big-endian:
+//   "RDTS", u32 files, u64 manifest bytes (this prefix included),
+//   per file: u64 size, u64 mtime (s), u32 mode, u16 path bytes, path
+// Paths are relative, '/'-separated, without "." or ".." components.
+static constexpr size_t SESSION_PREFIX = 16;
+static constexpr uint64_t SESSION_MAX_MANIFEST = 64 << 20;
+
+struct SessionFile {
+    std::string path;
+    uint64_t size = 0;
+    uint64_t mtime = 0;
+    uint32_t mode = 0;
+    uint64_t off = 0;   // stream offset of its first byte (set by the layout)
+};
+
+static inline void put_be(uint8_t*& p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) *p++ = uint8_t(v >> (8 * i));
+}
+
+static inline uint64_t get_be(const uint8_t* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+static inline bool session_path_ok(const std::string& path) {
+    if (path.empty() || path.size() > 0xFFFF || path[0] == '/') return false;
+    size_t b = 0;
+    for (;;) {
+        size_t e = path.find('/', b);
+        std::string c = path.substr(b, e == std::string::npos ? std::string::npos : e - b);
+        if (c.empty() || c == "." || c == ".." || c.find_first_of("\\:") != std::string::npos) return false;
+        if (e == std::string::npos) return true;
+        b = e + 1;
+    }
+}
+
+// The manifest of files; sets every file's stream offset.
+static inline std::vector<uint8_t> encode_manifest(std::vector<SessionFile>& files) {
+    size_t n = SESSION_PREFIX;
+    for (const SessionFile& f : files) n += 22 + f.path.size();
+    std::vector<uint8_t> m(n);
+    uint8_t* p = m.data();
+    std::memcpy(p, "RDTS", 4);
+    p += 4;
+    put_be(p, files.size(), 4);
+    put_be(p, n, 8);
+    uint64_t off = n;
+    for (SessionFile& f : files) {
+        put_be(p, f.size, 8);
+        put_be(p, f.mtime, 8);
+        put_be(p, f.mode, 4);
+        put_be(p, f.path.size(), 2);
+        std::memcpy(p, f.path.data(), f.path.size());
+        p += f.path.size();
+        f.off = off;
+        off += f.size;
+    }
+    return m;
+}
+
+// Manifest length from its first SESSION_PREFIX bytes (0: not a manifest).
+static inline uint64_t manifest_length(const uint8_t* p) {
+    if (std::memcmp(p, "RDTS", 4) != 0) return 0;
+    uint64_t n = get_be(p + 8, 8);
+    return n >= SESSION_PREFIX && n <= SESSION_MAX_MANIFEST ? n : 0;
+}
+
+static inline bool parse_manifest(const uint8_t* p, size_t n, std::vector<SessionFile>& files) {
+    files.clear();
+    if (n < SESSION_PREFIX || manifest_length(p) != n) return false;
+    uint64_t count = get_be(p + 4, 4), off = n;
+    size_t i = SESSION_PREFIX;
+    for (uint64_t k = 0; k < count; k++) {
+        if (i + 22 > n) return false;
+        SessionFile f;
+        f.size = get_be(p + i, 8);
+        f.mtime = get_be(p + i + 8, 8);
+        f.mode = (uint32_t)get_be(p + i + 16, 4);
+        size_t len = (size_t)get_be(p + i + 20, 2);
+        if (i + 22 + len > n) return false;
+        f.path.assign((const char*)p + i + 22, len);
+        f.off = off;
+        off += f.size;
+        i += 22 + len;
+        files.push_back(std::move(f));
+    }
+    return i == n;
+}
+
+// ====== fast-open cookies ======
+// A receiver's cookie for a client is a MAC of the client's IP under a key
+// drawn at startup (SipHash-2-4, as Linux uses for TCP Fast Open cookies):
+// it costs no per-client state, and a forged cookie, or one issued before a
+// restart, fails validation and only costs the normal handshake.
+static inline uint64_t sip_rotl(uint64_t x, int b) { return (x << b) | (x >> (64 - b)); }
+
+static inline uint64_t siphash24(const uint64_t key[2], const uint8_t* in, size_t n) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0], v1 = 0x646f72616e646f6dULL ^ key[1];
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0], v3 = 0x7465646279746573ULL ^ key[1];
+    auto round = [&]() {
+        v0 += v1; v1 = sip_rotl(v1, 13); v1 ^= v0; v0 = sip_rotl(v0, 32);
+        v2 += v3; v3 = sip_rotl(v3, 16); v3 ^= v2;
+        v0 += v3; v3 = sip_rotl(v3, 21); v3 ^= v0;
+        v2 += v1; v1 = sip_rotl(v1, 17); v1 ^= v2; v2 = sip_rotl(v2, 32);
+    };
+    size_t full = n - n % 8;
+    for (size_t i = 0; i < full; i += 8) {
+        uint64_t m = 0;
+        for (int k = 7; k >= 0; k--) m = (m << 8) | in[i + k];   // little-endian words
+        v3 ^= m; round(); round(); v0 ^= m;
+    }
+    uint64_t m = (uint64_t)n << 56;
+    for (size_t k = 0; k < n % 8; k++) m |= (uint64_t)in[full + k] << (8 * k);
+    v3 ^= m; round(); round(); v0 ^= m;
+    v2 ^= 0xff;
+    round(); round(); round(); round();
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static inline uint64_t fastopen_cookie(const uint64_t key[2], const sockaddr_in& client) {
+    uint64_t c = siphash24(key, (const uint8_t*)&client.sin_addr.s_addr, 4);
+    return c ? c : 1;   // 0 stands for "no cookie"
 }
 
 // checksum is computed in host-order representation consistently on both ends (same as original logic)
-static inline void fill_checksum(RdtHeader& h, const uint8_t* payload) {
+// header, options (h.optlen wire bytes) and payload are summed where they lie;
+// sizeof(RdtHeader) and optlen are even.
+// psum is the payload's checksum_add() sum if the caller cached it (retransmits
+// then only fold the header in).
+static inline uint16_t packet_checksum(const RdtHeader& h, const uint8_t* opt, const uint8_t* payload,
+                                       uint32_t psum = RDT_NO_PSUM) {
+    uint32_t sum = checksum_add(0, (const uint8_t*)&h, sizeof(RdtHeader));
+    if (h.optlen > 0 && opt) sum = checksum_add(sum, opt, h.optlen);
+    if (h.len > 0 && payload) {
+        if (psum == RDT_NO_PSUM) psum = checksum_add(0, payload, h.len);
+        sum = csum_fold((uint64_t)sum + psum);
+    }
+    return uint16_t(~sum & 0xFFFF);
+}
+
+static inline void fill_checksum(RdtHeader& h, const uint8_t* opt, const uint8_t* payload,
+                                 uint32_t psum = RDT_NO_PSUM) {
     h.cksum = 0;
-    uint8_t buf[RDT_MAX_PKT];
-    const size_t hdr_len = sizeof(RdtHeader);
-    std::memcpy(buf, &h, hdr_len);
-    if (h.len > 0 && payload) std::memcpy(buf + hdr_len, payload, h.len);
-    h.cksum = checksum16(buf, hdr_len + h.len);
+    h.cksum = packet_checksum(h, opt, payload, psum);
 }
 
-static inline bool verify_checksum(const RdtHeader& h, const uint8_t* payload) {
+static inline bool verify_checksum(const RdtHeader& h, const uint8_t* opt, const uint8_t* payload) {
     RdtHeader tmp = h;
     tmp.cksum = 0;
-    uint8_t buf[RDT_MAX_PKT];
-    const size_t hdr_len = sizeof(RdtHeader);
-    std::memcpy(buf, &tmp, hdr_len);
-    if (h.len > 0 && payload) std::memcpy(buf + hdr_len, payload, h.len);
-    uint16_t c = checksum16(buf, hdr_len + h.len);
-    return c == h.cksum;
+    return packet_checksum(tmp, opt, payload) == h.cksum;
 }
 
 static inline void die(const char* msg) {
@@ -123,26 +760,375 @@ static inline void die(const char* msg) {
     std::exit(1);
 }
 
+// Value of an optional trailing "--name=value" argument (nullptr if absent).
+static inline const char* opt_value(int argc, char** argv, int first, const char* name) {
+    size_t n = std::strlen(name);
+    for (int i = first; i < argc; i++) {
+        const char* a = argv[i];
+        if (a[0] == '-' && a[1] == '-' && std::strncmp(a + 2, name, n) == 0 && a[2 + n] == '=')
+            return a + 3 + n;
+    }
+    return nullptr;
+}
+
+// "--name" alone, or "--name=V" with V other than 0
+static inline bool opt_flag(int argc, char** argv, int first, const char* name) {
+    for (int i = first; i < argc; i++) {
+        const char* a = argv[i];
+        if (a[0] == '-' && a[1] == '-' && std::strcmp(a + 2, name) == 0) return true;
+    }
+    const char* v = opt_value(argc, argv, first, name);
+    return v && std::strcmp(v, "0") != 0;
+}
+
+// The first argument from argv[first] on that is not "--name" or
+// "--name=V" for one of names (nullptr: every option is known).
+template <size_t N>
+static inline const char* unknown_option(int argc, char** argv, int first, const char* const (&names)[N]) {
+    for (int i = first; i < argc; i++) {
+        const char* a = argv[i];
+        bool known = false;
+        if (a[0] == '-' && a[1] == '-') {
+            size_t n = std::strcspn(a + 2, "=");
+            for (const char* name : names) known = known || (std::strlen(name) == n && std::strncmp(a + 2, name, n) == 0);
+        }
+        if (!known) return a;
+    }
+    return nullptr;
+}
+
 static inline void set_nonblocking(SOCKET s) {
+#ifdef _WIN32
     u_long mode = 1;
     if (ioctlsocket(s, FIONBIO, &mode) != 0) die("ioctlsocket nonblocking failed");
+#else
+    int fl = fcntl(s, F_GETFL, 0);
+    if (fl < 0 || fcntl(s, F_SETFL, fl | O_NONBLOCK) != 0) die("fcntl nonblocking failed");
+#endif
+}
+
+// Ask for socket buffers that hold a whole window (bytes) of datagrams (the
+// OS may cap the request, e.g. net.core.rmem_max); returns the receive buffer
+// size actually granted.
+static inline int set_socket_buffers(SOCKET s, uint64_t window) {
+    int want = (int)std::min<uint64_t>(window * 2, 64 << 20);
+    want = std::max(want, 256 * 1024);
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char*)&want, sizeof(want));
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, (const char*)&want, sizeof(want));
+    int got = 0;
+    socklen_t len = sizeof(got);
+    getsockopt(s, SOL_SOCKET, SO_RCVBUF, (char*)&got, &len);
+    return got;
+}
+
+// Let several sockets bind the same port; the kernel then spreads incoming
+// flows across them by a hash of the 4-tuple, so one peer always reaches the
+// same socket. False where SO_REUSEPORT does not exist (Windows).
+static inline bool set_reuseport(SOCKET s) {
+#ifdef SO_REUSEPORT
+    int on = 1;
+    return setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char*)&on, sizeof(on)) == 0;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+// Don't fragment: a datagram larger than the path MTU is dropped (or refused
+// with EMSGSIZE by the local interface) instead of being split, which is what
+// path MTU probing relies on. ICMP "too big" is ignored (Linux PMTUDISC_PROBE):
+// probes alone decide the segment size. False where unsupported.
+static inline bool set_dont_fragment(SOCKET s) {
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+    int v = IP_PMTUDISC_PROBE;
+    return setsockopt(s, IPPROTO_IP, IP_MTU_DISCOVER, &v, sizeof(v)) == 0;
+#elif defined(IP_DONTFRAGMENT)
+    DWORD on = 1;
+    return setsockopt(s, IPPROTO_IP, IP_DONTFRAGMENT, (const char*)&on, sizeof(on)) == 0;
+#elif defined(IP_DONTFRAG)
+    int on = 1;
+    return setsockopt(s, IPPROTO_IP, IP_DONTFRAG, (const char*)&on, sizeof(on)) == 0;
+#else
+    (void)s;
+    return false;
+#endif
+}
+
+static inline bool would_block() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+// ====== Event wait ======
+// Block until the socket has a datagram pending or timeout_ms expires
+// (timeout_ms < 0 waits forever). Returns >0 if readable, 0 on timeout.
+static inline int wait_readable(SOCKET s, int timeout_ms) {
+    if (VirtualNet* v = virtual_net()) return v->wait(s, timeout_ms);
+#ifdef _WIN32
+    WSAPOLLFD p{};
+    p.fd = s;
+    p.events = POLLRDNORM;
+    return WSAPoll(&p, 1, timeout_ms);
+#else
+    pollfd p{};
+    p.fd = s;
+    p.events = POLLIN;
+    int r;
+    do { r = poll(&p, 1, timeout_ms); } while (r < 0 && errno == EINTR);
+    return r;
+#endif
+}
+
+// Poll timeout in ms from t until deadline, both in us (rounded up so we
+// never wake early; 0 if already due, -1 if no deadline).
+static inline int ms_until(uint64_t deadline, uint64_t t) {
+    if (deadline == UINT64_MAX) return -1;
+    return deadline > t ? int((deadline - t + 999) / 1000) : 0;
+}
+
+// ====== Adaptive retransmission timeout (RFC 6298) ======
+// Jacobson/Karels SRTT/RTTVAR in microseconds. Callers must only feed
+// samples from segments that were never retransmitted (Karn's rule).
+struct RtoEstimator {
+    int64_t srtt_us   = -1;   // < 0 until the first sample
+    int64_t rttvar_us = 0;
+    int64_t rto_us    = int64_t(RDT_RTO_INIT_MS) * 1000;
+    int backoff       = 0;    // consecutive timeouts since the last sample
+    uint64_t samples  = 0;
+
+    void on_sample(int64_t r) {
+        if (r < 0) return;
+        if (srtt_us < 0) {
+            srtt_us = r;
+            rttvar_us = r / 2;
+        } else {
+            int64_t err = srtt_us > r ? srtt_us - r : r - srtt_us;
+            rttvar_us = (3 * rttvar_us + err) / 4;
+            srtt_us = (7 * srtt_us + r) / 8;
+        }
+        samples++;
+        backoff = 0;
+        rto_us = clamp(srtt_us + std::max<int64_t>(1000, 4 * rttvar_us));
+    }
+
+    // Exponential backoff after a retransmission timeout.
+    void on_timeout() {
+        backoff++;
+        rto_us = clamp(rto_us * 2);
+    }
+
+    uint64_t rto() const { return (uint64_t)rto_us; }
+
+    static int64_t clamp(int64_t v) {
+        return std::min<int64_t>(std::max<int64_t>(v, int64_t(RDT_RTO_MIN_MS) * 1000),
+                                 int64_t(RDT_RTO_MAX_MS) * 1000);
+    }
+};
+
+// Scatter-gather send of a network-order header (+ encoded options, hlen bytes
+// in all) plus payload (no staging copy).
+static inline int send_iov(SOCKET s, const sockaddr_in& peer, const uint8_t* head, size_t hlen,
+                           const uint8_t* payload, uint16_t len) {
+    if (VirtualNet* v = virtual_net()) return v->send(s, peer, head, hlen, payload, payload ? len : 0);
+#ifdef _WIN32
+    WSABUF bufs[2];
+    bufs[0].buf = (CHAR*)head;
+    bufs[0].len = (ULONG)hlen;
+    bufs[1].buf = (CHAR*)payload;
+    bufs[1].len = len;
+    DWORD sent = 0;
+    int r = WSASendTo(s, bufs, (len > 0 && payload) ? 2 : 1, &sent, 0,
+                      (const sockaddr*)&peer, sizeof(peer), nullptr, nullptr);
+    return r == 0 ? (int)sent : SOCKET_ERROR;
+#else
+    iovec iov[2];
+    iov[0].iov_base = (void*)head;
+    iov[0].iov_len = hlen;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = len;
+    msghdr m{};
+    m.msg_name = (void*)&peer;
+    m.msg_namelen = sizeof(peer);
+    m.msg_iov = iov;
+    m.msg_iovlen = (len > 0 && payload) ? 2 : 1;
+    return (int)sendmsg(s, &m, 0);
+#endif
+}
+
+// Build header + options in wire form into head (sizeof(RdtHeader) + RDT_MAX_OPT
+// bytes); returns the bytes used.
+static inline size_t build_head(RdtHeader h, const RdtOptions* opt, const uint8_t* payload,
+                                uint32_t psum, uint8_t* head) {
+    uint8_t* obuf = head + sizeof(RdtHeader);
+    uint16_t optlen = opt ? encode_options(*opt, obuf) : 0;
+    h.optlen = optlen;
+    fill_checksum(h, obuf, payload, psum);
+    hton_header(h);
+    std::memcpy(head, &h, sizeof(RdtHeader));
+    return sizeof(RdtHeader) + optlen;
 }
 
-static inline int send_pkt(SOCKET s, const sockaddr_in& peer, RdtHeader h, const uint8_t* payload) {
-    fill_checksum(h, payload);
-    RdtHeader net = h;
-    hton_header(net);
+static inline int send_pkt(SOCKET s, const sockaddr_in& peer, RdtHeader h, const uint8_t* payload,
+                           uint32_t psum = RDT_NO_PSUM, const RdtOptions* opt = nullptr) {
+    uint8_t head[sizeof(RdtHeader) + RDT_MAX_OPT];
+    size_t hlen = build_head(h, opt, payload, psum, head);
+    return send_iov(s, peer, head, hlen, payload, h.len);
+}
 
-    uint8_t buf[RDT_MAX_PKT];
-    std::memcpy(buf, &net, sizeof(RdtHeader));
-    if (h.len > 0 && payload) std::memcpy(buf + sizeof(RdtHeader), payload, h.len);
+// Validate a received datagram in place.
+// On success h holds the host-order header, opt the decoded options, and
+// payload points into buf.
+static inline bool parse_pkt(uint8_t* buf, int n, RdtHeader& h, RdtOptions& opt, uint8_t*& payload) {
+    if (n < (int)sizeof(RdtHeader)) return false;
+    std::memcpy(&h, buf, sizeof(RdtHeader));
+    ntoh_header(h);
+    const uint8_t* obuf = buf + sizeof(RdtHeader);
+    payload = buf + sizeof(RdtHeader) + h.optlen;
+    if ((int)(sizeof(RdtHeader) + h.optlen + h.len) > n) return false;
+    if (!verify_checksum(h, obuf, payload)) return false;
+    return decode_options(obuf, h.optlen, opt);
+}
 
-    return sendto(
-        s,
-        (const char*)buf,
-        int(sizeof(RdtHeader) + h.len),
-        0,
-        (const sockaddr*)&peer,
-        sizeof(peer)
-    );
+static inline bool parse_pkt(uint8_t* buf, int n, RdtHeader& h, uint8_t*& payload) {
+    RdtOptions opt;
+    return parse_pkt(buf, n, h, opt, payload);
+}
+
+// ====== Batched datagram I/O ======
+// Linux uses sendmmsg/recvmmsg; elsewhere each datagram is its own call.
+struct IoStats {
+    uint64_t tx_pkts = 0, tx_calls = 0;
+    uint64_t rx_pkts = 0, rx_calls = 0;
+
+    double tx_per_call() const { return tx_calls ? double(tx_pkts) / tx_calls : 0.0; }
+    double rx_per_call() const { return rx_calls ? double(rx_pkts) / rx_calls : 0.0; }
+};
+
+// Staged packets keep only their network-order header and options; the
+// payload is referenced in place and must stay valid until flush_batch().
+struct TxBatch {
+    int n = 0;
+    uint8_t head[RDT_BATCH][sizeof(RdtHeader) + RDT_MAX_OPT];
+    uint16_t hlen[RDT_BATCH];
+    const uint8_t* payload[RDT_BATCH];
+    uint16_t len[RDT_BATCH];
+
+    bool full() const { return n == RDT_BATCH; }
+
+    // Checksum, convert and stage one packet (caller flushes when full()).
+    void add(RdtHeader h, const uint8_t* data, uint32_t psum = RDT_NO_PSUM,
+             const RdtOptions* opt = nullptr) {
+        hlen[n] = (uint16_t)build_head(h, opt, data, psum, head[n]);
+        payload[n] = (h.len > 0) ? data : nullptr;
+        len[n] = payload[n] ? h.len : 0;
+        n++;
+    }
+};
+
+// Every slot takes the largest datagram; the buffer is left uninitialized,
+// so pages a batch never fills are never touched.
+struct RxBatch {
+    int n = 0;
+    std::unique_ptr<uint8_t[]> buf;
+    int len[RDT_BATCH];
+    sockaddr_in from[RDT_BATCH];
+
+    RxBatch() : buf(new uint8_t[(size_t)RDT_BATCH * RDT_MAX_PKT]) {}
+    uint8_t* slot(int i) { return buf.get() + (size_t)i * RDT_MAX_PKT; }
+};
+
+// Send every staged packet to peer and empty the batch. Returns packets sent;
+// packets the kernel refuses (e.g. full socket buffer) are dropped like on the wire.
+static inline int flush_batch(SOCKET s, const sockaddr_in& peer, TxBatch& b, IoStats& st) {
+    int sent = 0;
+    if (VirtualNet* v = virtual_net()) {
+        for (int i = 0; i < b.n; i++) {
+            if (v->send(s, peer, b.head[i], b.hlen[i], b.payload[i], b.len[i]) >= 0) sent++;
+        }
+        st.tx_calls++;
+        st.tx_pkts += (uint64_t)sent;
+        b.n = 0;
+        return sent;
+    }
+#ifdef RDT_HAVE_MMSG
+    mmsghdr msgs[RDT_BATCH];
+    iovec iov[RDT_BATCH][2];
+    for (int i = 0; i < b.n; i++) {
+        iov[i][0].iov_base = b.head[i];
+        iov[i][0].iov_len = b.hlen[i];
+        iov[i][1].iov_base = (void*)b.payload[i];
+        iov[i][1].iov_len = b.len[i];
+        std::memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_name = (void*)&peer;
+        msgs[i].msg_hdr.msg_namelen = sizeof(peer);
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = b.payload[i] ? 2 : 1;
+    }
+    while (sent < b.n) {
+        int r = sendmmsg(s, msgs + sent, (unsigned)(b.n - sent), 0);
+        st.tx_calls++;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        sent += r;
+    }
+#else
+    for (int i = 0; i < b.n; i++) {
+        int r = send_iov(s, peer, b.head[i], b.hlen[i], b.payload[i], b.len[i]);
+        st.tx_calls++;
+        if (r >= 0) sent++;
+    }
+#endif
+    st.tx_pkts += (uint64_t)sent;
+    b.n = 0;
+    return sent;
+}
+
+// Receive up to RDT_BATCH pending datagrams without blocking.
+// Returns the number received (0 if nothing is pending).
+static inline int recv_batch(SOCKET s, RxBatch& b, IoStats& st) {
+    b.n = 0;
+    if (VirtualNet* v = virtual_net()) {
+        int r;
+        while (b.n < RDT_BATCH && (r = v->recv(s, b.slot(b.n), RDT_MAX_PKT, b.from[b.n])) >= 0) b.len[b.n++] = r;
+        st.rx_calls++;
+        st.rx_pkts += (uint64_t)b.n;
+        return b.n;
+    }
+#ifdef RDT_HAVE_MMSG
+    mmsghdr msgs[RDT_BATCH];
+    iovec iov[RDT_BATCH];
+    for (int i = 0; i < RDT_BATCH; i++) {
+        iov[i].iov_base = b.slot(i);
+        iov[i].iov_len = RDT_MAX_PKT;
+        std::memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_name = &b.from[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int r;
+    do { r = recvmmsg(s, msgs, RDT_BATCH, MSG_DONTWAIT, nullptr); } while (r < 0 && errno == EINTR);
+    st.rx_calls++;
+    if (r <= 0) return 0;
+    for (int i = 0; i < r; i++) b.len[i] = (int)msgs[i].msg_len;
+    b.n = r;
+#else
+    for (int tries = 0; b.n < RDT_BATCH && tries < 2 * RDT_BATCH; tries++) {
+        socklen_t fromlen = sizeof(sockaddr_in);
+        int r = recvfrom(s, (char*)b.slot(b.n), RDT_MAX_PKT, 0, (sockaddr*)&b.from[b.n], &fromlen);
+        st.rx_calls++;
+        if (r < 0) {
+            if (would_block()) break;
+            continue;  // e.g. WSAECONNRESET from an earlier ICMP error
+        }
+        b.len[b.n++] = r;
+    }
+#endif
+    st.rx_pkts += (uint64_t)b.n;
+    return b.n;
 }
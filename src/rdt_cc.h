@@ -0,0 +1,466 @@
+#pragma once
+// Sender congestion control: how many segments may be in flight.
+//
+//   reno  - Reno/NewReno: slow start, AIMD, halve on loss (SACK pipe recovery)
+//   cubic - CUBIC (RFC 9438): cubic window growth around the last W_max
+//   bbr   - BBR-style model: bottleneck bandwidth x min RTT, loss-agnostic
+//
+// The sender owns loss detection (dupACKs, SACK, RTO) and calls the hooks
+// below; the controller owns cwnd and the pacing rate (see Pacer). All state lives in the object, so one
+// controller serves exactly one connection. cwnd is reported in segments of
+// the connection's current MSS (set_mss()); after an MSS change the window
+// need not be whole segments, so cwnd_bytes() is the exact figure.
+#include "rdt.h"
+#include <memory>
+#include <cmath>
+
+// What one ACK told the sender.
+struct AckEvent {
+    uint32_t acked = 0;       // bytes newly covered by the cumulative ACK
+    uint32_t delivered = 0;   // bytes newly delivered (cumulative + SACK)
+    int inflight = 0;         // segments still in flight after this ACK
+    uint64_t now_us = 0;
+};
+
+class CongestionController {
+public:
+    explicit CongestionController(int mss) : mss_(std::max(1, mss)) {}
+    virtual ~CongestionController() {}
+
+    virtual const char* name() const = 0;
+    virtual const char* phase() const = 0;   // for logs
+    virtual int cwnd() const = 0;            // segments (at least 1)
+    virtual int ssthresh() const = 0;        // segments
+    virtual double cwnd_bytes() const = 0;
+    virtual double ssthresh_bytes() const = 0;
+
+    // An ACK advanced the cumulative ACK or SACKed new data.
+    virtual void on_ack(const AckEvent& ev) = 0;
+    // Duplicate ACK number dup for the same cumulative ACK (the 3rd one
+    // triggers fast retransmit and arrives as on_loss instead).
+    virtual void on_dupack(int dup) { (void)dup; }
+    // Loss detected by dupACKs/SACK: recovery starts (once per episode).
+    virtual void on_loss(uint64_t now_us) = 0;
+    // The ACK that ends a recovery episode arrived.
+    virtual void on_recovery_exit() {}
+    // Retransmission timeout.
+    virtual void on_timeout(uint64_t now_us) = 0;
+    // Valid (Karn) RTT sample.
+    virtual void on_rtt_sample(int64_t rtt_us, uint64_t now_us) { (void)rtt_us; (void)now_us; }
+
+    // Pacing rate in bytes/s, 0 if unknown (no RTT yet). Default: cwnd per
+    // SRTT, x2 in slow start so pacing never holds back growth and x1.2
+    // otherwise to absorb ACK jitter (the gains Linux uses).
+    virtual double pacing_rate(int64_t srtt_us) const {
+        if (srtt_us <= 0) return 0.0;
+        double gain = cwnd() < ssthresh() ? 2.0 : 1.2;
+        return gain * cwnd() * mss_ * 1e6 / (double)srtt_us;
+    }
+
+    // The segment size changed (path MTU probe). cwnd and ssthresh keep
+    // their size in bytes, as Linux does after a successful MTU probe, so a
+    // larger MSS does not turn into a burst: a window smaller than one new
+    // segment stays that small (the sender cuts its segment to cwnd_bytes()).
+    void set_mss(int mss) {
+        if (mss <= 0 || mss == mss_) return;
+        double f = double(mss_) / mss;
+        mss_ = mss;
+        rescale(f);
+    }
+    int mss() const { return mss_; }
+
+protected:
+    // the MSS changed by 1/f: windows kept in segments are multiplied by f
+    virtual void rescale(double f) = 0;
+
+    int mss_;
+};
+
+// ====== reno: slow start + AIMD, byte counting (RFC 3465) ======
+// cwnd and ssthresh are kept in bytes (RFC 5681 terms), so an MSS change
+// leaves them alone.
+class RenoCC : public CongestionController {
+public:
+    RenoCC(uint64_t init_ssthresh, int mss)
+        : CongestionController(mss), cwnd_(mss_), ssthresh_(std::max(init_ssthresh, 2 * seg())) {}
+
+    const char* name() const override { return "reno"; }
+    const char* phase() const override {
+        return recovery_ ? "fast recovery" : cwnd_ < ssthresh_ ? "slow start" : "cong avoid";
+    }
+    int cwnd() const override { return (int)std::max<uint64_t>(1, cwnd_ / seg()); }
+    int ssthresh() const override { return (int)(ssthresh_ / seg()); }
+    double cwnd_bytes() const override { return (double)cwnd_; }
+    double ssthresh_bytes() const override { return (double)ssthresh_; }
+
+    void on_ack(const AckEvent& ev) override {
+        if (ev.acked == 0 || recovery_) return;
+        if (cwnd_ < ssthresh_) {
+            // slow start: cwnd += bytes acked, at most 2 MSS per ACK (L = 2)
+            cwnd_ = std::min(ssthresh_, cwnd_ + std::min<uint64_t>(ev.acked, 2 * seg()));
+        } else {
+            // congestion avoidance: cwnd += 1 MSS per cwnd bytes acked (never
+            // more than doubling a window still below one MSS)
+            acked_bytes_ += ev.acked;
+            if (acked_bytes_ >= cwnd_) {
+                acked_bytes_ -= cwnd_;
+                cwnd_ += std::min(seg(), cwnd_);
+            }
+        }
+    }
+
+    // No dupACK inflation: the sender limits itself by pipe (RFC 6675), which
+    // already leaves out SACKed and lost segments.
+    void on_loss(uint64_t) override {
+        ssthresh_ = half();
+        cwnd_ = ssthresh_;
+        acked_bytes_ = 0;
+        recovery_ = true;
+    }
+
+    // cwnd stays frozen at ssthresh until the full ACK
+    void on_recovery_exit() override {
+        if (!recovery_) return;
+        cwnd_ = ssthresh_;
+        recovery_ = false;
+    }
+
+    void on_timeout(uint64_t) override {
+        ssthresh_ = half();
+        cwnd_ = seg();
+        acked_bytes_ = 0;
+        recovery_ = false;
+    }
+
+protected:
+    void rescale(double) override { acked_bytes_ = 0; }
+
+private:
+    uint64_t seg() const { return (uint64_t)mss_; }
+    // half the window in whole segments, at least two
+    uint64_t half() const { return std::max(2 * seg(), cwnd_ / (2 * seg()) * seg()); }
+
+    uint64_t cwnd_;       // bytes
+    uint64_t ssthresh_;   // bytes
+    uint64_t acked_bytes_ = 0;
+    bool recovery_ = false;
+};
+
+// ====== cubic: W(t) = C (t - K)^3 + W_max (RFC 9438) ======
+// Growth depends on time since the last reduction rather than on ACK count,
+// so it recovers to the previous window quickly on long fixed-delay paths,
+// and a Reno-friendly estimate keeps it no slower than Reno.
+class CubicCC : public CongestionController {
+public:
+    static constexpr double C = 0.4;
+    static constexpr double BETA = 0.7;
+
+    CubicCC(uint64_t init_ssthresh, int mss)
+        : CongestionController(mss), ssthresh_(std::max(2.0, std::floor(double(init_ssthresh) / mss_))) {}
+
+    const char* name() const override { return "cubic"; }
+    const char* phase() const override {
+        return recovery_ ? "fast recovery" : cwnd_ < ssthresh_ ? "slow start" : "cubic";
+    }
+    int cwnd() const override { return std::max(1, (int)(cwnd_ + 1e-9)); }   // 1e-9: rescaling round trips
+    int ssthresh() const override { return (int)ssthresh_; }
+    double cwnd_bytes() const override { return cwnd_ * mss_; }
+    double ssthresh_bytes() const override { return ssthresh_ * mss_; }
+
+    void on_ack(const AckEvent& ev) override {
+        if (ev.acked == 0 || recovery_) return;
+        double segs = double(ev.acked) / mss_;
+        if (cwnd_ < ssthresh_) {
+            cwnd_ = std::min<double>(cwnd_ + std::min(segs, 2.0), ssthresh_);
+            return;
+        }
+        if (epoch_us_ == 0) {
+            epoch_us_ = ev.now_us;
+            if (w_max_ <= cwnd_) {
+                k_ = 0.0;
+                w_max_ = cwnd_;
+            } else {
+                k_ = std::cbrt((w_max_ - cwnd_) / C);
+            }
+            w_est_ = cwnd_;
+        }
+        double rtt_s = (min_rtt_us_ > 0 ? min_rtt_us_ : 100000) / 1e6;
+        double t = (ev.now_us - epoch_us_) / 1e6 + rtt_s;   // where the window will be one RTT from now
+        double target = C * std::pow(t - k_, 3.0) + w_max_;
+        target = std::min(std::max(target, cwnd_), 1.5 * cwnd_);
+
+        // Reno-friendly region (AIMD with the same average rate as Reno)
+        w_est_ += 3.0 * (1.0 - BETA) / (1.0 + BETA) * segs / cwnd_;
+        if (w_est_ > target) target = w_est_;
+
+        cwnd_ += (target - cwnd_) * segs / cwnd_;
+    }
+
+    void on_loss(uint64_t) override {
+        reduce();
+        recovery_ = true;
+    }
+
+    void on_recovery_exit() override { recovery_ = false; }
+
+    void on_timeout(uint64_t) override {
+        reduce();
+        cwnd_ = 1.0;
+        recovery_ = false;
+    }
+
+    void on_rtt_sample(int64_t rtt_us, uint64_t) override {
+        if (min_rtt_us_ == 0 || rtt_us < min_rtt_us_) min_rtt_us_ = rtt_us;
+    }
+
+protected:
+    // windows are fractional segments: no rounding, so bytes are kept exactly
+    void rescale(double f) override {
+        cwnd_ *= f;
+        ssthresh_ *= f;
+        w_max_ *= f;
+        w_est_ *= f;
+        epoch_us_ = 0;   // K is recomputed from the rescaled W_max
+    }
+
+private:
+    void reduce() {
+        epoch_us_ = 0;
+        // fast convergence: release bandwidth to newer flows
+        w_max_ = cwnd_ < w_max_ ? cwnd_ * (1.0 + BETA) / 2.0 : cwnd_;
+        cwnd_ = std::max(2.0, cwnd_ * BETA);
+        ssthresh_ = std::floor(cwnd_);
+    }
+
+    double cwnd_ = 1.0;     // segments
+    double ssthresh_;       // segments
+    double w_max_ = 0.0;
+    double k_ = 0.0;
+    double w_est_ = 0.0;
+    uint64_t epoch_us_ = 0;
+    int64_t min_rtt_us_ = 0;
+    bool recovery_ = false;
+};
+
+// ====== bbr: model-based, cwnd = gain x bottleneck bw x min RTT ======
+// A simplified BBR: delivery rate is sampled once per min-RTT interval and
+// fed to a max filter over the last BW_ROUNDS rounds; min RTT is the lowest
+// sample seen. STARTUP grows 2/ln2 per round until the bandwidth plateaus,
+// DRAIN empties the queue it built, PROBE_BW then cycles its gain. Random
+// loss does not shrink the window, which is what fixed-delay lossy links need.
+// There is no PROBE_RTT: the path delay here is fixed.
+class BbrCC : public CongestionController {
+public:
+    static constexpr int BW_ROUNDS = 10;
+    static constexpr double HIGH_GAIN = 2.885;   // 2/ln2
+    static constexpr double CWND_GAIN = 2.0;
+
+    BbrCC(uint64_t init_cwnd_cap, int mss)
+        : CongestionController(mss), cap_(std::max(init_cwnd_cap, 4 * seg())), cwnd_(4 * seg()) {}
+
+    const char* name() const override { return "bbr"; }
+    const char* phase() const override {
+        static const char* names[] = {"startup", "drain", "probe_bw"};
+        return names[mode_];
+    }
+    int cwnd() const override { return (int)std::max<uint64_t>(1, cwnd_ / seg()); }
+    int ssthresh() const override { return (int)(cap_ / seg()); }
+    double cwnd_bytes() const override { return (double)cwnd_; }
+    double ssthresh_bytes() const override { return (double)cap_; }
+
+    void on_ack(const AckEvent& ev) override {
+        if (round_start_us_ == 0) round_start_us_ = ev.now_us;
+        round_bytes_ += ev.delivered;
+
+        // one delivery-rate sample (and one "round") per min RTT
+        uint64_t span = ev.now_us - round_start_us_;
+        if (min_rtt_us_ > 0 && span >= (uint64_t)min_rtt_us_) {
+            double rate = round_bytes_ * 1e6 / span;   // bytes/s
+            bw_[round_ % BW_ROUNDS] = rate;
+            round_++;
+            round_bytes_ = 0;
+            round_start_us_ = ev.now_us;
+            on_round(ev);
+        }
+        update_cwnd(ev);
+    }
+
+    void on_timeout(uint64_t) override {
+        // packet conservation: restart from a small window, the model refills it
+        cwnd_ = seg();
+    }
+    void on_loss(uint64_t) override {}
+
+    void on_rtt_sample(int64_t rtt_us, uint64_t) override {
+        if (min_rtt_us_ == 0 || rtt_us < min_rtt_us_) min_rtt_us_ = rtt_us;
+    }
+
+    // pacing_gain x bottleneck bw once there is a model, cwnd/SRTT before
+    double pacing_rate(int64_t srtt_us) const override {
+        double bw = max_bw();
+        if (bw == 0.0) return CongestionController::pacing_rate(srtt_us);
+        double gain = mode_ == STARTUP ? HIGH_GAIN
+                    : mode_ == DRAIN   ? 1.0 / HIGH_GAIN
+                    : cycle_gain(cycle_);
+        return gain * bw;
+    }
+
+protected:
+    // the model and the window are in bytes
+    void rescale(double) override {}
+
+private:
+    enum Mode { STARTUP, DRAIN, PROBE_BW };
+
+    // PROBE_BW: one round probing above the model, one draining below it, six cruising
+    static double cycle_gain(int i) {
+        static const double g[8] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+        return g[i];
+    }
+
+    double max_bw() const {
+        double m = 0.0;
+        for (double b : bw_) m = std::max(m, b);
+        return m;
+    }
+
+    // bandwidth-delay product in segments
+    double bdp() const { return max_bw() * (min_rtt_us_ / 1e6) / mss_; }
+
+    void on_round(const AckEvent& ev) {
+        double bw = max_bw();
+        if (mode_ == STARTUP) {
+            // full pipe: bandwidth grew < 25% for 3 rounds
+            if (bw >= full_bw_ * 1.25) {
+                full_bw_ = bw;
+                full_cnt_ = 0;
+            } else if (++full_cnt_ >= 3) {
+                mode_ = DRAIN;
+            }
+        } else if (mode_ == DRAIN) {
+            if (ev.inflight <= bdp()) {
+                mode_ = PROBE_BW;
+                cycle_ = 0;
+            }
+        } else {
+            cycle_ = (cycle_ + 1) % 8;
+        }
+    }
+
+    uint64_t seg() const { return (uint64_t)mss_; }
+    // what was delivered, in whole segments (at least one)
+    uint64_t grow(const AckEvent& ev) const { return std::max<uint64_t>(1, ev.delivered / seg()) * seg(); }
+
+    void update_cwnd(const AckEvent& ev) {
+        if (min_rtt_us_ == 0 || max_bw() == 0.0) {
+            // no model yet: slow-start-like growth
+            cwnd_ = std::min(cap_, cwnd_ + grow(ev));
+            return;
+        }
+        // the cycle gain also goes into the window, so BBR still probes when
+        // pacing is off (--pace-gain=0)
+        double gain = mode_ == STARTUP ? HIGH_GAIN
+                    : mode_ == DRAIN   ? 1.0
+                    : CWND_GAIN * cycle_gain(cycle_);
+        uint64_t target = (uint64_t)std::max(4, (int)std::ceil(gain * bdp())) * seg();
+        // grow toward the target by what was delivered; shrink at once
+        if (cwnd_ < target) cwnd_ = std::min(target, cwnd_ + grow(ev));
+        else cwnd_ = target;
+        cwnd_ = std::min(cwnd_, cap_);
+    }
+
+    uint64_t cap_;    // bytes
+    uint64_t cwnd_;   // bytes
+    Mode mode_ = STARTUP;
+    double bw_[BW_ROUNDS] = {};
+    uint64_t round_ = 0;
+    uint64_t round_start_us_ = 0;
+    uint64_t round_bytes_ = 0;
+    int64_t min_rtt_us_ = 0;
+    double full_bw_ = 0.0;
+    int full_cnt_ = 0;
+    int cycle_ = 0;
+};
+
+// ====== pacing: token bucket over the controller's rate ======
+// Spreads DATA (new and retransmitted) at gain x pacing_rate() instead of
+// sending whatever cwnd allows back-to-back, so a window that opens after
+// recovery or a stretch ACK does not hit the router queue as one burst.
+// The bucket holds RDT_PACE_QUANTUM_US worth of data: the event loop sleeps
+// in whole milliseconds, and a smaller bucket would lose rate to timer slack.
+// gain 0 disables pacing; max_rate (bytes/s, 0 = none) is a hard cap that
+// applies even then.
+class Pacer {
+public:
+    Pacer(double gain, double max_rate) : gain_(gain), max_rate_(max_rate) {}
+
+    // base: controller rate in bytes/s (0 = unknown, send freely)
+    void set_rate(double base, uint64_t now) {
+        refill(now);
+        rate_ = gain_ > 0.0 ? gain_ * base : 0.0;
+        if (max_rate_ > 0.0 && (rate_ == 0.0 || rate_ > max_rate_)) rate_ = max_rate_;
+    }
+
+    // May a segment go out now? (a segment may overdraw the bucket)
+    bool ready(uint64_t now) {
+        if (rate_ <= 0.0) return true;
+        refill(now);
+        if (tokens_ > 0.0) return true;
+        waits_++;
+        return false;
+    }
+
+    void on_send(uint32_t bytes) {
+        if (rate_ > 0.0) tokens_ -= bytes;
+    }
+
+    // When ready() turns true again (now if not pacing).
+    uint64_t next_send_us(uint64_t now) const {
+        if (rate_ <= 0.0 || tokens_ > 0.0) return now;
+        return now + (uint64_t)(-tokens_ * 1e6 / rate_) + 1;
+    }
+
+    // segment size behind the burst floor
+    void set_mss(int mss) { mss_ = mss; }
+
+    double rate() const { return rate_; }
+    uint64_t waits() const { return waits_; }
+
+private:
+    double burst() const {
+        return std::max((double)RDT_PACE_MIN_BURST * mss_, rate_ * RDT_PACE_QUANTUM_US / 1e6);
+    }
+
+    void refill(uint64_t now) {
+        if (last_us_ == 0) tokens_ = burst();
+        else if (now > last_us_) tokens_ = std::min(burst(), tokens_ + rate_ * (now - last_us_) / 1e6);
+        last_us_ = now;
+    }
+
+    double gain_;
+    double max_rate_;
+    int mss_ = RDT_MSS;
+    double rate_ = 0.0;
+    double tokens_ = 0.0;   // bytes; negative after a segment overdraws
+    uint64_t last_us_ = 0;
+    uint64_t waits_ = 0;
+};
+
+enum CcAlgo { CC_RENO, CC_CUBIC, CC_BBR };
+
+static inline bool parse_cc_algo(const char* s, CcAlgo& a) {
+    if (std::strcmp(s, "reno") == 0)  { a = CC_RENO;  return true; }
+    if (std::strcmp(s, "cubic") == 0) { a = CC_CUBIC; return true; }
+    if (std::strcmp(s, "bbr") == 0)   { a = CC_BBR;   return true; }
+    return false;
+}
+
+// wnd_bytes is the flow-control window: initial ssthresh for reno/cubic,
+// cwnd cap for bbr. mss is the segment size the connection starts with.
+static inline std::unique_ptr<CongestionController> make_cc(CcAlgo a, uint64_t wnd_bytes, int mss) {
+    switch (a) {
+    case CC_CUBIC: return std::unique_ptr<CongestionController>(new CubicCC(wnd_bytes, mss));
+    case CC_BBR:   return std::unique_ptr<CongestionController>(new BbrCC(wnd_bytes, mss));
+    default:       return std::unique_ptr<CongestionController>(new RenoCC(wnd_bytes, mss));
+    }
+}
@@ -0,0 +1,226 @@
+#pragma once
+// Forward error correction: one XOR parity segment per block of K DATA segments.
+//
+// The sender XORs the payloads of K consecutive first transmissions (zero-
+// padded to the longest) and sends the result as an F_FEC segment: its seq is
+// the block's first byte, its OPT_FEC lists the K lengths. The receiver keeps
+// recent payloads in a ring by stream offset, so when exactly one segment of
+// a block is missing it rebuilds it from the parity and the others: no
+// retransmission, no dupACK round, no cwnd reduction. Two losses in one block
+// fall back to SACK recovery.
+//
+// In auto mode K follows the loss rate the sender sees (retransmissions plus
+// the segments the receiver reports rebuilt and lost, less the segments it
+// reports receiving twice): about 0.15 / p, so a block
+// rarely holds two losses, clamped to [2, RDT_FEC_MAX_K]; below 0.1% loss no
+// parity is sent at all.
+#include "rdt.h"
+#include <deque>
+
+static constexpr int FEC_EPOCH = 64;              // first transmissions per loss-rate update
+static constexpr double FEC_OFF_BELOW = 0.001;    // auto: no parity below this loss rate
+static constexpr double FEC_PRIOR = 0.01;         // auto: loss rate assumed until the first update
+static constexpr size_t FEC_WAIT = 4;             // receiver: parities kept while their block has two holes
+static constexpr size_t FEC_RING_MAX = 16u << 20; // receiver: the ring grows no larger (older blocks then go unrebuilt)
+// A parity segment carries OPT_FEC, a DATA segment no options: DATA payload
+// is cut by this much so the parity fits wherever a full DATA segment does.
+static constexpr int FEC_OPT_ROOM = (2 + 2 * RDT_FEC_MAX_K + 3) & ~3;
+
+// "auto" or K (0 = off)
+static inline bool parse_fec(const char* s, int& mode) {
+    if (std::strcmp(s, "auto") == 0) { mode = -1; return true; }
+    char* end = nullptr;
+    long k = std::strtol(s, &end, 10);
+    if (!end || *end || k < 0 || k > RDT_FEC_MAX_K) return false;
+    mode = (int)k;
+    return true;
+}
+
+static inline int fec_k_for(double p) {
+    if (p < FEC_OFF_BELOW) return 0;
+    return std::max(2, std::min(RDT_FEC_MAX_K, (int)(0.15 / p)));
+}
+
+static inline void xor_into(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, 8);
+        std::memcpy(&b, src + i, 8);
+        a ^= b;
+        std::memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; i++) dst[i] ^= src[i];
+}
+
+// ====== Sender: parity of each block as it is sent ======
+class FecEncoder {
+public:
+    // mode: 0 off, -1 auto (K from the loss rate), else a fixed K
+    explicit FecEncoder(int mode)
+        : mode_(mode), k_(mode < 0 ? fec_k_for(FEC_PRIOR) : mode), slots_(RDT_BATCH) {}
+
+    void enable() { on_ = mode_ != 0; }   // the receiver answered OPT_FEC
+    bool on() const { return on_; }
+    int k() const { return k_; }
+    double loss() const { return p_; }
+    uint64_t sent() const { return sent_; }
+    uint64_t parity() const { return parity_; }
+    bool pending() const { return n_ > 0; }
+    bool full() const { return n_ > 0 && n_ >= blk_k_; }
+
+    // A first transmission. window is what may be in flight: a block no
+    // larger than that is complete (and its parity sent) before the sender
+    // has to wait for an ACK the receiver is holding for it.
+    void add(uint32_t seq, const uint8_t* p, uint16_t len, int window) {
+        sent_++;
+        if (k_ == 0) return;
+        if (n_ == 0) {
+            seq_ = seq;
+            plen_ = 0;
+            blk_k_ = std::max(2, std::min(k_, window));
+        }
+        if (len > plen_) {
+            if (work_.size() < len) work_.resize(len);
+            std::memset(work_.data() + plen_, 0, len - plen_);
+            plen_ = len;
+        }
+        xor_into(work_.data(), p, len);
+        len_[n_++] = len;
+    }
+
+    // The block so far as a parity segment (seq, len, OPT_FEC). Its payload
+    // is parked with TxBatch slot `slot` and stays valid until that batch
+    // is flushed.
+    const uint8_t* take(int slot, RdtHeader& h, RdtOptions& opt) {
+        std::vector<uint8_t>& b = slots_[slot];
+        std::swap(b, work_);
+        h.seq = seq_;
+        h.len = plen_;
+        opt.fec_n = n_;
+        std::copy(len_, len_ + n_, opt.fec_len);
+        n_ = 0;
+        parity_++;
+        return b.data();
+    }
+
+    // losses: retransmissions + segments rebuilt by the receiver, so far;
+    // spurious: segments the receiver got twice (a retransmission that was
+    // not needed: reordering or jitter, not loss), so far. The receiver
+    // reports a duplicate about an RTT after the retransmission, so a loss
+    // counts only once settle_us (an RTO) has passed, and a duplicate not yet
+    // matched by a loss carries over to the next epoch.
+    // Once per epoch the loss rate is folded into an EWMA and K follows it.
+    void observe(uint64_t losses, uint64_t spurious, uint64_t now, uint64_t settle_us) {
+        if (mode_ >= 0) return;
+        if (marks_.empty() ? losses != settled_ : losses != marks_.back().second)
+            marks_.push_back(std::make_pair(now, losses));
+        while (!marks_.empty() && now - marks_.front().first >= settle_us) {
+            settled_ = marks_.front().second;
+            marks_.pop_front();
+        }
+        if (sent_ - epoch_sent_ < (uint64_t)FEC_EPOCH) return;
+        uint64_t lost = settled_ - epoch_loss_, dup = std::min(lost, spurious - std::min(spurious, epoch_dup_));
+        double sample = double(lost - dup) / double(sent_ - epoch_sent_);
+        p_ = 0.75 * p_ + 0.25 * std::min(1.0, sample);
+        k_ = fec_k_for(p_);
+        epoch_sent_ = sent_;
+        epoch_loss_ = settled_;
+        epoch_dup_ += dup;
+    }
+
+private:
+    int mode_;
+    bool on_ = false;
+    int k_;
+    double p_ = FEC_PRIOR;
+    uint64_t sent_ = 0, parity_ = 0;
+    uint64_t epoch_sent_ = 0, epoch_loss_ = 0, epoch_dup_ = 0;
+    uint64_t settled_ = 0;                                  // losses at least settle_us old
+    std::deque<std::pair<uint64_t, uint64_t>> marks_;       // (time, losses) not yet settled
+
+    // the block being built
+    int n_ = 0, blk_k_ = 0;
+    uint32_t seq_ = 0;
+    uint16_t plen_ = 0;
+    uint16_t len_[RDT_FEC_MAX_K];
+    std::vector<uint8_t> work_;
+    std::vector<std::vector<uint8_t>> slots_;   // parities staged in the current batch
+};
+
+// ====== Receiver: recent payloads by stream offset ======
+// A block's other segments are needed after they went to the writer, so
+// every DATA payload is copied here too. The ring holds the last size()
+// bytes below the highest offset written; the receiver sizes it for its
+// window of the largest segment seen, so every segment of a block that still
+// has a hole is normally there (holds() tells when it is not).
+class FecRing {
+public:
+    // Room for `bytes` (a power of two, at most FEC_RING_MAX); what the
+    // ring holds is kept.
+    void reserve(size_t bytes) {
+        size_t n = std::max<size_t>(buf_.size(), 4096);
+        while (n < bytes && n < FEC_RING_MAX) n <<= 1;
+        if (n == buf_.size()) return;
+        std::vector<uint8_t> old(n, 0);
+        old.swap(buf_);
+        if (old.empty()) return;
+        uint64_t off = high_ > old.size() ? high_ - old.size() : 0;
+        size_t om = old.size() - 1, nm = buf_.size() - 1;
+        while (off < high_) {
+            size_t k = (size_t)std::min<uint64_t>(high_ - off, std::min(old.size() - (off & om), buf_.size() - (off & nm)));
+            std::memcpy(buf_.data() + (off & nm), old.data() + (off & om), k);
+            off += k;
+        }
+    }
+
+    // The bytes from off on are still held.
+    bool holds(uint64_t off) const { return !buf_.empty() && off + buf_.size() >= high_; }
+
+    void keep(uint64_t off, const uint8_t* p, size_t n) {
+        if (buf_.empty()) return;
+        if (off + n > high_) high_ = off + n;
+        if (off + buf_.size() < high_) {
+            // only the part not already overtaken
+            size_t skip = (size_t)std::min<uint64_t>(n, high_ - buf_.size() - off);
+            off += skip; p += skip; n -= skip;
+        }
+        size_t mask = buf_.size() - 1;
+        while (n > 0) {
+            size_t at = (size_t)off & mask;
+            size_t k = std::min(n, buf_.size() - at);
+            std::memcpy(buf_.data() + at, p, k);
+            off += k; p += k; n -= k;
+        }
+    }
+
+    // XOR the n bytes at off into dst
+    void fold(uint64_t off, size_t n, uint8_t* dst) const {
+        size_t mask = buf_.size() - 1;
+        while (n > 0) {
+            size_t at = (size_t)off & mask;
+            size_t k = std::min(n, buf_.size() - at);
+            xor_into(dst, buf_.data() + at, k);
+            off += k; dst += k; n -= k;
+        }
+    }
+
+private:
+    std::vector<uint8_t> buf_;
+    uint64_t high_ = 0;   // end of the highest bytes written
+};
+
+// A parity segment the receiver could not use yet
+struct FecBlock {
+    uint32_t seq = 0;
+    int n = 0;
+    uint16_t len[RDT_FEC_MAX_K];
+    std::vector<uint8_t> parity;
+};
+
+// A segment rebuilt from parity: a loss only if the original never shows up
+// (jitter or reordering may just have delayed it past its parity).
+struct FecRebuilt {
+    uint32_t seq = 0;
+    uint64_t at_us = 0;
+};
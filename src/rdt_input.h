@@ -0,0 +1,520 @@
+#pragma once
+// Sender input sources: where DATA payload bytes come from.
+//
+//   read   - whole file read into memory up front (original behaviour)
+//   mmap   - file mapped read-only, pages faulted in on demand
+//   stream - bounded read-ahead in fixed chunks on a reader thread; works
+//            with stdin/pipes (default)
+//   session - many files as one stream (a manifest, then their contents),
+//            read ahead like stream
+//
+// Segments are views into the source (see OutSeg::data), so a byte range
+// must stay valid until release() says the cumulative ACK has passed it.
+#include "rdt.h"
+#include "rdt_ring.h"
+#include <functional>
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+class InputSource {
+public:
+    virtual ~InputSource() {}
+
+    // Contiguous bytes at stream offset off, at most max_len long. Returns
+    // nullptr (len = 0) if nothing is available at off right now; at_end()
+    // tells whether more can ever arrive.
+    virtual const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) = 0;
+
+    // True once the source is known to hold no byte at or after off.
+    virtual bool at_end(uint64_t off) const = 0;
+
+    // Bytes before off are acknowledged and will never be peeked again.
+    virtual void release(uint64_t off) { (void)off; }
+
+    // Total size if known up front (UINT64_MAX for streams).
+    virtual uint64_t size() const { return UINT64_MAX; }
+};
+
+// ====== read: whole file in one buffer ======
+class BufferedInput : public InputSource {
+public:
+    explicit BufferedInput(FILE* fp) {
+        std::fseek(fp, 0, SEEK_END);
+        long fsz = std::ftell(fp);
+        std::fseek(fp, 0, SEEK_SET);
+        data_.resize((size_t)std::max(0L, fsz));
+        if (fsz > 0) data_.resize(std::fread(data_.data(), 1, (size_t)fsz, fp));
+    }
+
+    const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) override {
+        len = off < data_.size() ? (size_t)std::min<uint64_t>(max_len, data_.size() - off) : 0;
+        return len ? data_.data() + off : nullptr;
+    }
+    bool at_end(uint64_t off) const override { return off >= data_.size(); }
+    uint64_t size() const override { return data_.size(); }
+
+private:
+    std::vector<uint8_t> data_;
+};
+
+// ====== mmap: map the file, let the kernel fault pages in ======
+class MappedInput : public InputSource {
+public:
+    explicit MappedInput(const std::string& path) {
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) die("cannot open input file");
+        LARGE_INTEGER sz;
+        if (!GetFileSizeEx(file_, &sz)) die("GetFileSizeEx");
+        size_ = (uint64_t)sz.QuadPart;
+        if (size_ > 0) {
+            map_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (!map_) die("CreateFileMapping");
+            base_ = (const uint8_t*)MapViewOfFile(map_, FILE_MAP_READ, 0, 0, 0);
+            if (!base_) die("MapViewOfFile");
+        }
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) die("cannot open input file");
+        struct stat st;
+        if (fstat(fd_, &st) != 0) die("fstat");
+        size_ = (uint64_t)st.st_size;
+        if (size_ > 0) {
+            void* p = mmap(nullptr, (size_t)size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (p == MAP_FAILED) die("mmap");
+            madvise(p, (size_t)size_, MADV_SEQUENTIAL);
+            base_ = (const uint8_t*)p;
+        }
+#endif
+    }
+
+    ~MappedInput() override {
+#ifdef _WIN32
+        if (base_) UnmapViewOfFile(base_);
+        if (map_) CloseHandle(map_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+#else
+        if (base_) munmap((void*)base_, (size_t)size_);
+        if (fd_ >= 0) ::close(fd_);
+#endif
+    }
+
+    const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) override {
+        len = off < size_ ? (size_t)std::min<uint64_t>(max_len, size_ - off) : 0;
+        return len ? base_ + off : nullptr;
+    }
+    bool at_end(uint64_t off) const override { return off >= size_; }
+    uint64_t size() const override { return size_; }
+
+private:
+    const uint8_t* base_ = nullptr;
+    uint64_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE map_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// 64-bit size of a regular file (UINT64_MAX for pipes and terminals).
+static inline uint64_t file_size(FILE* fp) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_fstat64(_fileno(fp), &st) != 0 || !(st.st_mode & _S_IFREG)) return UINT64_MAX;
+#else
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) return UINT64_MAX;
+#endif
+    return (uint64_t)st.st_size;
+}
+
+static inline bool file_seek(FILE* fp, uint64_t off) {
+#ifdef _WIN32
+    return _fseeki64(fp, (__int64)off, SEEK_SET) == 0;
+#else
+    return fseeko(fp, (off_t)off, SEEK_SET) == 0;
+#endif
+}
+
+// ====== stream: bounded read-ahead over a pool of fixed chunks ======
+// Chunk k holds stream bytes [k*chunk, (k+1)*chunk) in slot k % nchunks.
+// The chunk size is a multiple of the base MSS, so a base-size segment never
+// straddles two chunks (a larger probed segment may end short at a chunk
+// boundary; peek() never returns bytes of two chunks). A reader thread fills free slots and hands them over
+// through an SpscRing; a slot goes back to it only after the cumulative ACK
+// has released the chunk, which keeps memory flat whatever the input size.
+// peek() never blocks: a chunk still being read just looks unavailable.
+class StreamInput : public InputSource {
+public:
+    static constexpr size_t CHUNK = 256 * (size_t)RDT_MSS;
+    static constexpr uint64_t MAX_AHEAD = 64 << 20;   // read-ahead cap (bytes)
+
+    // Called on the reader thread: up to n bytes into buf, 0 at the end.
+    typedef std::function<size_t(uint8_t* buf, size_t n)> ReadFn;
+
+    // At most limit bytes are read from fp's current position; size is
+    // reported by size() (UINT64_MAX for pipes). window: the sender's window in bytes.
+    StreamInput(FILE* fp, uint64_t window, uint64_t limit = UINT64_MAX, uint64_t size = UINT64_MAX)
+        : StreamInput([fp](uint8_t* buf, size_t n) { return std::fread(buf, 1, n, fp); }, window, limit, size) {}
+
+    StreamInput(ReadFn read, uint64_t window, uint64_t limit, uint64_t size)
+        : read_(std::move(read)), limit_(limit), size_(size), nchunks_(chunks_for(window)),
+          filled_(nchunks_), free_(nchunks_) {
+        pool_.resize(nchunks_ * CHUNK);
+        len_.assign(nchunks_, 0);
+        for (size_t i = 0; i < nchunks_; i++) free_.push((uint32_t)i);
+    }
+
+    ~StreamInput() override {
+        if (!reader_.joinable()) return;
+        stop_.store(true);
+        waker_.wake();
+        reader_.join();
+    }
+
+    const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) override {
+        len = 0;
+        // the reader starts on first use, so an input opened only for its size costs nothing
+        if (!reader_.joinable()) reader_ = std::thread(&StreamInput::reader, this);
+        Filled f;
+        while (filled_.pop(f)) {
+            if (f.len > 0) {
+                len_[f.slot] = f.len;
+                read_end_ += f.len;
+                next_chunk_++;
+            }
+            if (f.eof) eof_ = true;
+        }
+
+        uint64_t k = off / CHUNK;
+        if (k < released_chunk_ || k >= next_chunk_) return nullptr;
+        size_t in = (size_t)(off - k * CHUNK);
+        size_t have = len_[k % nchunks_];
+        if (in >= have) return nullptr;
+        len = std::min(max_len, have - in);
+        return pool_.data() + (k % nchunks_) * CHUNK + in;
+    }
+
+    bool at_end(uint64_t off) const override { return eof_ && off >= read_end_; }
+
+    void release(uint64_t off) override {
+        uint64_t k = std::min(off / CHUNK, next_chunk_);
+        if (k <= released_chunk_) return;
+        for (; released_chunk_ < k; released_chunk_++) free_.push((uint32_t)(released_chunk_ % nchunks_));
+        waker_.wake();
+    }
+
+    uint64_t size() const override { return size_; }
+
+private:
+    struct Filled {
+        uint32_t slot;
+        uint32_t len;
+        bool eof;
+    };
+
+    static size_t chunks_for(uint64_t window) {
+        // a few windows of read-ahead
+        uint64_t want = std::min(3 * std::max<uint64_t>(window, RDT_MSS), MAX_AHEAD);
+        return std::max<size_t>(2, (size_t)((want + CHUNK - 1) / CHUNK));
+    }
+
+    // ====== reader thread: fill free slots in stream order ======
+    void reader() {
+        uint64_t done = 0;
+        for (;;) {
+            waker_.wait([this] { return !free_.empty() || stop_.load(); });
+            uint32_t slot;
+            if (stop_.load() || !free_.pop(slot)) return;
+            size_t want = (size_t)std::min<uint64_t>(CHUNK, limit_ - done);
+            size_t got = 0;
+            bool eof = false;
+            while (got < want) {
+                size_t r = read_(pool_.data() + (size_t)slot * CHUNK + got, want - got);
+                if (r == 0) { eof = true; break; }
+                got += r;
+            }
+            done += got;
+            if (done == limit_) eof = true;
+            filled_.push(Filled{slot, (uint32_t)got, eof});   // never full: one entry per slot
+            if (eof) return;
+        }
+    }
+
+    ReadFn read_;
+    uint64_t limit_;
+    uint64_t size_;
+    size_t nchunks_;
+    std::vector<uint8_t> pool_;
+    std::vector<size_t> len_;
+    SpscRing<Filled> filled_;       // reader -> protocol
+    SpscRing<uint32_t> free_;       // protocol -> reader
+    Waker waker_;
+    std::atomic<bool> stop_{false};
+    std::thread reader_;
+
+    // protocol thread only
+    uint64_t next_chunk_ = 0;       // first chunk not handed over yet
+    uint64_t released_chunk_ = 0;   // chunks below this are acked and reusable
+    uint64_t read_end_ = 0;
+    bool eof_ = false;
+};
+
+// ====== memory: a caller-owned buffer (the simulator's input) ======
+class MemoryInput : public InputSource {
+public:
+    MemoryInput(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) override {
+        len = off < size_ ? (size_t)std::min<uint64_t>(max_len, size_ - off) : 0;
+        return len ? data_ + off : nullptr;
+    }
+    bool at_end(uint64_t off) const override { return off >= size_; }
+    uint64_t size() const override { return size_; }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+};
+
+// ====== range: bytes [begin, end) of another source (one stripe) ======
+// The whole-file sources never change what peek() returns, so several
+// stripes may read one of them from different threads.
+class RangeInput : public InputSource {
+public:
+    RangeInput(InputSource& src, uint64_t begin, uint64_t end) : src_(src), begin_(begin), end_(end) {}
+
+    const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) override {
+        len = 0;
+        if (begin_ + off >= end_) return nullptr;
+        return src_.peek(begin_ + off, (size_t)std::min<uint64_t>(max_len, end_ - begin_ - off), len);
+    }
+    bool at_end(uint64_t off) const override { return begin_ + off >= end_; }
+    uint64_t size() const override { return end_ - begin_; }
+
+private:
+    InputSource& src_;
+    uint64_t begin_, end_;
+};
+
+// ====== session: many files as one stream (framing in rdt.h) ======
+// The reader thread produces the manifest and then each file's bytes in
+// order, so small files share chunks and segments instead of costing a
+// connection each. A file that shrank or vanished since it was listed is
+// padded with zeros (one that grew is cut at its listed size): the receiver
+// places bytes by the sizes in the manifest.
+//
+// Per-file timing is taken on the protocol thread: a file starts when its
+// first byte is first peeked (sent) and completes when the cumulative ACK
+// passes its last byte.
+class SessionInput : public InputSource {
+public:
+    // files: wire paths and metadata; local: where to read each one
+    SessionInput(std::vector<SessionFile> files, std::vector<std::string> local, uint64_t window)
+        : files_(std::move(files)), local_(std::move(local)), manifest_(encode_manifest(files_)),
+          start_us_(files_.size(), 0), done_us_(files_.size(), 0) {
+        size_ = manifest_.size();
+        for (const SessionFile& f : files_) size_ += f.size;
+        stream_.reset(new StreamInput([this](uint8_t* buf, size_t n) { return produce(buf, n); },
+                                      window, UINT64_MAX, size_));
+    }
+
+    ~SessionInput() override {
+        stream_.reset();   // joins the reader before the file it reads is closed
+        if (fp_) std::fclose(fp_);
+    }
+
+    const uint8_t* peek(uint64_t off, size_t max_len, size_t& len) override {
+        const uint8_t* p = stream_->peek(off, max_len, len);
+        for (; started_ < files_.size() && files_[started_].off < off + len; started_++) {
+            start_us_[started_] = now_us();
+        }
+        return p;
+    }
+
+    bool at_end(uint64_t off) const override { return stream_->at_end(off); }
+
+    void release(uint64_t off) override {
+        stream_->release(off);
+        for (; done_ < files_.size() && files_[done_].off + files_[done_].size <= off; done_++) {
+            done_us_[done_] = now_us();
+            if (start_us_[done_] == 0) start_us_[done_] = done_us_[done_];   // empty file
+        }
+    }
+
+    uint64_t size() const override { return size_; }
+
+    const std::vector<SessionFile>& files() const { return files_; }
+    uint64_t manifest_bytes() const { return manifest_.size(); }
+    // 0 until the file's first byte was sent / its last byte acknowledged
+    uint64_t start_us(size_t i) const { return start_us_[i]; }
+    uint64_t done_us(size_t i) const { return done_us_[i]; }
+    // files padded or cut because they changed since they were listed (read
+    // by the reader thread: only meaningful once the transfer is over)
+    uint64_t changed() const { return changed_; }
+
+private:
+    // reader thread: manifest, then the files in order
+    size_t produce(uint8_t* buf, size_t n) {
+        size_t got = 0;
+        while (got < n) {
+            if (pos_ < manifest_.size()) {
+                size_t k = std::min<size_t>(n - got, manifest_.size() - (size_t)pos_);
+                std::memcpy(buf + got, manifest_.data() + pos_, k);
+                pos_ += k;
+                got += k;
+                continue;
+            }
+            if (cur_ >= files_.size()) break;
+            const SessionFile& f = files_[cur_];
+            if (in_file_ == f.size) {
+                if (fp_) {
+                    if (std::fgetc(fp_) != EOF) changed_++;   // grew since it was listed
+                    std::fclose(fp_);
+                    fp_ = nullptr;
+                }
+                cur_++;
+                in_file_ = 0;
+                continue;
+            }
+            if (in_file_ == 0 && !fp_) fp_ = std::fopen(local_[cur_].c_str(), "rb");
+            size_t want = (size_t)std::min<uint64_t>(n - got, f.size - in_file_);
+            size_t r = fp_ ? std::fread(buf + got, 1, want, fp_) : 0;
+            if (r == 0) {
+                std::memset(buf + got, 0, want);
+                r = want;
+                if (fp_) {
+                    std::fclose(fp_);
+                    fp_ = nullptr;
+                }
+                if (!padding_) changed_++;
+                padding_ = true;
+            }
+            got += r;
+            in_file_ += r;
+            if (in_file_ == f.size) padding_ = false;
+        }
+        return got;
+    }
+
+    std::vector<SessionFile> files_;
+    std::vector<std::string> local_;
+    std::vector<uint8_t> manifest_;
+    uint64_t size_ = 0;
+
+    // reader thread only
+    uint64_t pos_ = 0;        // manifest bytes produced
+    size_t cur_ = 0;          // file being read
+    uint64_t in_file_ = 0;    // its bytes produced
+    FILE* fp_ = nullptr;
+    bool padding_ = false;
+    uint64_t changed_ = 0;
+
+    // protocol thread only
+    std::vector<uint64_t> start_us_, done_us_;
+    size_t started_ = 0, done_ = 0;
+
+    std::unique_ptr<StreamInput> stream_;   // last: its reader uses the members above
+};
+
+enum InputMode { IN_READ, IN_MMAP, IN_STREAM };
+
+static inline bool parse_input_mode(const char* s, InputMode& m) {
+    if (std::strcmp(s, "read") == 0)   { m = IN_READ;   return true; }
+    if (std::strcmp(s, "mmap") == 0)   { m = IN_MMAP;   return true; }
+    if (std::strcmp(s, "stream") == 0) { m = IN_STREAM; return true; }
+    return false;
+}
+
+// path "-" means stdin (always streamed). The FILE* of read/stream modes is
+// owned by the caller; window (bytes) sizes the stream read-ahead.
+static inline std::unique_ptr<InputSource> open_input(const std::string& path, InputMode mode,
+                                                      uint64_t window, FILE** fp_out) {
+    *fp_out = nullptr;
+    if (path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        return std::unique_ptr<InputSource>(new StreamInput(stdin, window));
+    }
+    if (mode == IN_MMAP) return std::unique_ptr<InputSource>(new MappedInput(path));
+
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    if (!fp) die("cannot open input file");
+    *fp_out = fp;
+    if (mode == IN_STREAM) return std::unique_ptr<InputSource>(new StreamInput(fp, window, UINT64_MAX, file_size(fp)));
+    std::unique_ptr<InputSource> in(new BufferedInput(fp));
+    std::fclose(fp);
+    *fp_out = nullptr;
+    return in;
+}
+
+// Bytes [begin, end) of a file streamed through a handle and reader thread
+// of their own (one stripe in stream mode). The FILE* is owned by the caller.
+static inline std::unique_ptr<InputSource> open_stream_range(const std::string& path, uint64_t window,
+                                                             uint64_t begin, uint64_t end, FILE** fp_out) {
+    FILE* fp = std::fopen(path.c_str(), "rb");
+    if (!fp) die("cannot open input file");
+    if (!file_seek(fp, begin)) die("seek input file");
+    *fp_out = fp;
+    return std::unique_ptr<InputSource>(new StreamInput(fp, window, end - begin, end - begin));
+}
+
+// Wire path of a listed file: '/'-separated, without a leading "/", "./"
+// or drive letter. Empty if it still is not a safe relative path.
+static inline std::string session_wire_path(std::string p) {
+    std::replace(p.begin(), p.end(), '\\', '/');
+    if (p.size() >= 2 && p[1] == ':') p.erase(0, 2);
+    for (;;) {
+        if (!p.empty() && p[0] == '/') p.erase(0, 1);
+        else if (p.compare(0, 2, "./") == 0) p.erase(0, 2);
+        else break;
+    }
+    return session_path_ok(p) ? p : std::string();
+}
+
+// Session over the files named in list, one path per line ("-": stdin).
+// Entries that are not regular files or have no safe relative path are
+// skipped with a warning; window (bytes) sizes the read-ahead.
+static inline std::unique_ptr<SessionInput> open_session(const std::string& list, uint64_t window) {
+    FILE* lf = list == "-" ? stdin : std::fopen(list.c_str(), "r");
+    if (!lf) die("cannot open file list");
+    std::vector<SessionFile> files;
+    std::vector<std::string> local;
+    char line[4096];
+    while (std::fgets(line, sizeof(line), lf)) {
+        std::string path(line);
+        while (!path.empty() && (path.back() == '\n' || path.back() == '\r')) path.pop_back();
+        if (path.empty()) continue;
+        SessionFile f;
+        f.path = session_wire_path(path);
+#ifdef _WIN32
+        struct _stat64 st;
+        bool regular = _stat64(path.c_str(), &st) == 0 && (st.st_mode & _S_IFREG);
+#else
+        struct stat st;
+        bool regular = stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+#endif
+        if (!regular || f.path.empty()) {
+            LOG("Session: skipping %s (%s)", path.c_str(), regular ? "no safe relative path" : "not a regular file");
+            continue;
+        }
+        f.size = (uint64_t)st.st_size;
+        f.mtime = (uint64_t)std::max<int64_t>(0, (int64_t)st.st_mtime);
+        f.mode = (uint32_t)st.st_mode & 0777;
+        files.push_back(f);
+        local.push_back(path);
+    }
+    if (lf != stdin) std::fclose(lf);
+    return std::unique_ptr<SessionInput>(new SessionInput(std::move(files), std::move(local), window));
+}
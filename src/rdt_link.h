@@ -0,0 +1,128 @@
+#pragma once
+// Link impairment model shared by the UDP relay (rdt_netem.cpp) and the
+// simulator (rdt_sim.h): per-direction loss (Bernoulli or Gilbert-Elliott),
+// delay plus jitter, reordering, duplication, a rate-limited drop-tail
+// queue and an MTU. Times are in microseconds on whatever clock the caller uses; all
+// randomness comes from the caller's seeded generator.
+#include "rdt.h"
+
+// ====== Impairments of one direction ======
+struct Impair {
+    double loss = 0.0;                 // Bernoulli loss probability
+    // Gilbert-Elliott: P(good->bad), P(bad->good), loss in good / bad state
+    bool ge = false;
+    double ge_p = 0.0, ge_r = 1.0, ge_good = 0.0, ge_bad = 1.0;
+    double delay_ms = 0.0;
+    double jitter_ms = 0.0;            // uniform extra delay in [0, jitter]
+    double reorder = 0.0;              // probability a packet skips the delay line (overtakes)
+    double dup = 0.0;                  // probability a packet is sent twice
+    double rate_mbit = 0.0;            // link rate in Mbit/s (0 = unlimited)
+    int queue = 100;                   // packets waiting for the link (drop-tail)
+    int mtu = 0;                       // largest datagram carried, UDP payload bytes (0 = any)
+
+    bool any() const {
+        return loss > 0 || ge || delay_ms > 0 || jitter_ms > 0 || reorder > 0 || dup > 0 || rate_mbit > 0 || mtu > 0;
+    }
+};
+
+// "--name=v" for client->server, "--rev-name=v" for server->client
+// the options parse_impair() reads (after the prefix)
+static const char* const IMPAIR_OPTS[] = {"loss", "ge", "delay", "jitter", "reorder", "dup", "rate", "queue", "mtu"};
+
+static inline void parse_impair(int argc, char** argv, int first, const char* prefix, Impair& im) {
+    auto opt = [&](const char* name) { return opt_value(argc, argv, first, (std::string(prefix) + name).c_str()); };
+    auto prob = [](const char* v) { return std::max(0.0, std::min(1.0, std::atof(v))); };
+    if (const char* v = opt("loss")) im.loss = prob(v);
+    if (const char* v = opt("ge")) {
+        if (std::sscanf(v, "%lf,%lf,%lf,%lf", &im.ge_p, &im.ge_r, &im.ge_good, &im.ge_bad) < 2)
+            die("bad --ge (p,r[,loss_good,loss_bad])");
+        im.ge = true;
+    }
+    if (const char* v = opt("delay")) im.delay_ms = std::max(0.0, std::atof(v));
+    if (const char* v = opt("jitter")) im.jitter_ms = std::max(0.0, std::atof(v));
+    if (const char* v = opt("reorder")) im.reorder = prob(v);
+    if (const char* v = opt("dup")) im.dup = prob(v);
+    if (const char* v = opt("rate")) im.rate_mbit = std::max(0.0, std::atof(v));
+    if (const char* v = opt("queue")) im.queue = std::max(1, std::atoi(v));
+    if (const char* v = opt("mtu")) im.mtu = std::max(0, std::atoi(v));
+}
+
+static inline void print_impair(const char* dir, const Impair& im) {
+    if (!im.any()) {
+        LOG("%s: clean", dir);
+        return;
+    }
+    char ge[96] = "off";
+    if (im.ge) std::snprintf(ge, sizeof(ge), "p=%.4f r=%.4f loss=%.3f/%.3f", im.ge_p, im.ge_r, im.ge_good, im.ge_bad);
+    LOG("%s: loss=%.4f ge=%s delay=%.1f+%.1f ms reorder=%.3f dup=%.3f rate=%.1f Mbit/s queue=%d mtu=%d",
+        dir, im.loss, ge, im.delay_ms, im.jitter_ms, im.reorder, im.dup, im.rate_mbit, im.queue, im.mtu);
+}
+
+struct DirStats {
+    uint64_t rx = 0, tx = 0;
+    uint64_t lost = 0, queue_drops = 0, pool_drops = 0, too_big = 0;
+    uint64_t dups = 0, reordered = 0;
+};
+
+// ====== One direction: loss model, link queue, delay ======
+class Direction {
+public:
+    Direction(const Impair& im, std::mt19937_64& rng)
+        : im_(im), rng_(rng), backlog_((size_t)im.queue) {}
+
+    // Drop decision for the next packet (Gilbert-Elliott state advances per packet).
+    bool drop() {
+        if (im_.ge) {
+            bad_ = bad_ ? !chance(im_.ge_r) : chance(im_.ge_p);
+            if (chance(bad_ ? im_.ge_bad : im_.ge_good)) return true;
+        }
+        return im_.loss > 0 && chance(im_.loss);
+    }
+
+    bool duplicate() { return im_.dup > 0 && chance(im_.dup); }
+
+    // Larger than the MTU: dropped silently, as a DF datagram is by a router
+    // that no longer sends ICMP "too big".
+    bool too_big(int len) const { return im_.mtu > 0 && len > im_.mtu; }
+
+    // Release time of a len-byte packet arriving at t, or 0 if the link
+    // queue is full. Serialization at the link rate comes first, then the
+    // propagation delay (+ jitter); a reordered packet skips the delay.
+    uint64_t schedule(uint64_t t, int len) {
+        uint64_t depart = t;
+        if (im_.rate_mbit > 0) {
+            while (nbacklog_ > 0 && backlog_[head_] <= t) pop_backlog();
+            if (nbacklog_ == (size_t)im_.queue) {
+                stats.queue_drops++;
+                return 0;
+            }
+            link_free_ = std::max(link_free_, t) + (uint64_t)(len * 8.0 / im_.rate_mbit);
+            depart = link_free_;
+            backlog_[(head_ + nbacklog_++) % backlog_.size()] = depart;
+        }
+        if (im_.reorder > 0 && chance(im_.reorder)) {
+            stats.reordered++;
+            return std::max<uint64_t>(depart, 1);
+        }
+        double d = im_.delay_ms;
+        if (im_.jitter_ms > 0) d += im_.jitter_ms * uni_(rng_);
+        return std::max<uint64_t>(depart + (uint64_t)(d * 1000.0), 1);
+    }
+
+    DirStats stats;
+
+private:
+    bool chance(double p) { return uni_(rng_) < p; }
+    void pop_backlog() {
+        head_ = (head_ + 1) % backlog_.size();
+        nbacklog_--;
+    }
+
+    Impair im_;
+    std::mt19937_64& rng_;
+    std::uniform_real_distribution<double> uni_{0.0, 1.0};
+    bool bad_ = false;
+    uint64_t link_free_ = 0;
+    std::vector<uint64_t> backlog_;   // departure times of queued packets (fixed ring)
+    size_t head_ = 0, nbacklog_ = 0;
+};
@@ -0,0 +1,316 @@
+// Local network emulator: a UDP relay in the place of Router.exe.
+//
+// Same forwarding model as the router setup: the sender sends to the relay,
+// the relay forwards to the receiver, and the receiver's replies go back to
+// the sender through the relay. Each sender address gets its own upstream
+// socket, so several senders (or the stripes of one) can share a relay.
+//
+// Both directions can be impaired independently: loss (Bernoulli or
+// Gilbert-Elliott), fixed delay plus jitter, reordering, duplication and a
+// bandwidth limit with a bounded drop-tail queue. The RNG is seeded, so a run
+// with the same traffic and --seed replays the same impairments.
+//
+//   g++ -std=c++11 -O2 rdt_netem.cpp -o rdt_netem [-lws2_32]
+//   rdt_netem <listen_ip> <listen_port> <server_ip> <server_port> [options]
+#include "rdt.h"
+#include "rdt_link.h"
+#include <csignal>
+#include <ctime>
+#include <queue>
+#include <unordered_map>
+
+static constexpr int NETEM_POOL   = 16384;   // packets held at once (delay line + queues)
+static constexpr int NETEM_FLOWS  = 1024;    // sender addresses
+
+// ====== Packet pool and delay line ======
+struct Pkt {
+    uint64_t due;
+    uint64_t order;      // FIFO among packets due at the same time
+    SOCKET sock;
+    sockaddr_in dst;
+    int len;
+    std::vector<uint8_t> data;   // grows to the largest datagram this slot held
+};
+
+struct DueLater {
+    const std::vector<Pkt>* pool;
+    bool operator()(int a, int b) const {
+        const Pkt& x = (*pool)[a];
+        const Pkt& y = (*pool)[b];
+        return x.due != y.due ? x.due > y.due : x.order > y.order;
+    }
+};
+
+// Raw datagrams to per-packet destinations from one socket, a batch per call.
+// Returns packets sent.
+static int send_raw_batch(SOCKET s, Pkt* const* pkts, int n, IoStats& st) {
+#ifdef RDT_HAVE_MMSG
+    mmsghdr msgs[RDT_BATCH];
+    iovec iov[RDT_BATCH];
+    for (int i = 0; i < n; i++) {
+        iov[i].iov_base = pkts[i]->data.data();
+        iov[i].iov_len = (size_t)pkts[i]->len;
+        std::memset(&msgs[i], 0, sizeof(mmsghdr));
+        msgs[i].msg_hdr.msg_name = &pkts[i]->dst;
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    int sent = 0;
+    while (sent < n) {
+        int r = sendmmsg(s, msgs + sent, (unsigned)(n - sent), 0);
+        st.tx_calls++;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            break;   // full socket buffer: the rest are dropped like on the wire
+        }
+        sent += r;
+    }
+#else
+    int sent = 0;
+    for (int i = 0; i < n; i++) {
+        int r = sendto(s, (const char*)pkts[i]->data.data(), pkts[i]->len, 0, (const sockaddr*)&pkts[i]->dst,
+                       sizeof(sockaddr_in));
+        st.tx_calls++;
+        if (r >= 0) sent++;
+    }
+#endif
+    st.tx_pkts += (uint64_t)sent;
+    return sent;
+}
+
+// Block until one of the sockets is readable or timeout_us expires (< 0: forever).
+static void wait_any(std::vector<pollfd>& fds, int64_t timeout_us) {
+#ifdef _WIN32
+    WSAPoll(fds.data(), (ULONG)fds.size(), timeout_us < 0 ? -1 : int((timeout_us + 999) / 1000));
+#else
+    timespec ts;
+    ts.tv_sec = (time_t)(timeout_us / 1000000);
+    ts.tv_nsec = (long)(timeout_us % 1000000) * 1000;
+    ppoll(fds.data(), (nfds_t)fds.size(), timeout_us < 0 ? nullptr : &ts, nullptr);
+#endif
+}
+
+static volatile std::sig_atomic_t g_stop = 0;
+static void on_signal(int) { g_stop = 1; }
+
+struct Flow {
+    sockaddr_in client;
+    SOCKET up;           // our socket towards the server for this sender
+};
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        std::printf("Usage: rdt_netem <listen_ip> <listen_port> <server_ip> <server_port> [options]\n");
+        std::printf("Impairments of client->server; prefix with rev- (e.g. --rev-loss) for server->client:\n");
+        std::printf("  --loss=P          Bernoulli loss probability\n");
+        std::printf("  --ge=p,r[,lg,lb]  Gilbert-Elliott loss: P(good->bad), P(bad->good), loss in good/bad (default 0/1)\n");
+        std::printf("  --delay=MS        fixed one-way delay\n");
+        std::printf("  --jitter=MS       extra uniform delay in [0, MS] (may reorder)\n");
+        std::printf("  --reorder=P       probability a packet skips the delay and overtakes (needs --delay)\n");
+        std::printf("  --dup=P           probability a packet is duplicated\n");
+        std::printf("  --rate=MBIT       link rate in Mbit/s (default unlimited)\n");
+        std::printf("  --queue=N         link queue in packets, drop-tail (default 100)\n");
+        std::printf("  --mtu=N           drop datagrams larger than N bytes of UDP payload (default: none)\n");
+        std::printf("Other:\n");
+        std::printf("  --seed=N          RNG seed (default 1)\n");
+        std::printf("  --report=SEC      print counters every SEC seconds (default: only at exit)\n");
+        return 0;
+    }
+    std::string listen_ip = argv[1];
+    int listen_port       = std::atoi(argv[2]);
+    sockaddr_in server{};
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)std::atoi(argv[4]));
+    server.sin_addr.s_addr = inet_addr(argv[3]);
+
+    Impair fwd_im, rev_im;
+    parse_impair(argc, argv, 5, "", fwd_im);
+    parse_impair(argc, argv, 5, "rev-", rev_im);
+    uint64_t seed = 1;
+    if (const char* v = opt_value(argc, argv, 5, "seed")) seed = std::strtoull(v, nullptr, 10);
+    double report = 0.0;
+    if (const char* v = opt_value(argc, argv, 5, "report")) report = std::max(0.0, std::atof(v));
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::setvbuf(stdout, nullptr, _IOLBF, 1 << 16);
+
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) die("WSAStartup");
+
+    auto open_socket = [](const std::string& ip, int port) -> SOCKET {
+        SOCKET s = socket(AF_INET, SOCK_DGRAM, 0);
+        if (s == INVALID_SOCKET) die("socket");
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons((uint16_t)port);
+        a.sin_addr.s_addr = inet_addr(ip.c_str());
+        if (bind(s, (sockaddr*)&a, sizeof(a)) != 0) die("bind");
+        set_nonblocking(s);
+        set_socket_buffers(s, 64 << 20);
+        return s;
+    };
+    SOCKET lsock = open_socket(listen_ip, listen_port);
+
+    LOG("rdt_netem on %s:%d -> %s:%s (seed=%llu)", listen_ip.c_str(), listen_port, argv[3], argv[4],
+        (unsigned long long)seed);
+    print_impair("client->server", fwd_im);
+    print_impair("server->client", rev_im);
+
+    std::mt19937_64 rng(seed);
+    Direction fwd(fwd_im, rng), rev(rev_im, rng);
+
+    std::vector<Pkt> pool(NETEM_POOL);
+    std::vector<int> free_pkts;
+    free_pkts.reserve(NETEM_POOL);
+    for (int i = NETEM_POOL - 1; i >= 0; i--) free_pkts.push_back(i);
+    std::vector<int> heap_store;
+    heap_store.reserve(NETEM_POOL);
+    std::priority_queue<int, std::vector<int>, DueLater> line(DueLater{&pool}, std::move(heap_store));
+    uint64_t order = 0;
+
+    std::vector<Flow> flows;
+    std::unordered_map<uint64_t, size_t> flow_of;   // client ip:port -> flows index
+    std::vector<pollfd> fds(1);
+    fds[0].fd = lsock;
+    fds[0].events = POLLIN;
+
+    RxBatch rx;
+    IoStats io;
+    uint64_t start = now_us(), next_report = report > 0 ? start + (uint64_t)(report * 1e6) : UINT64_MAX;
+
+    // Queue one received datagram in direction d towards dst via sock.
+    auto admit = [&](Direction& d, SOCKET sock, const sockaddr_in& dst, const uint8_t* data, int len, uint64_t t) {
+        d.stats.rx++;
+        if (d.too_big(len)) {
+            d.stats.too_big++;
+            return;
+        }
+        if (d.drop()) {
+            d.stats.lost++;
+            return;
+        }
+        int copies = d.duplicate() ? 2 : 1;
+        if (copies == 2) d.stats.dups++;
+        for (int c = 0; c < copies; c++) {
+            uint64_t due = d.schedule(t, len);
+            if (due == 0) continue;
+            if (free_pkts.empty()) {
+                d.stats.pool_drops++;
+                continue;
+            }
+            int i = free_pkts.back();
+            free_pkts.pop_back();
+            Pkt& p = pool[i];
+            p.due = due;
+            p.order = order++;
+            p.sock = sock;
+            p.dst = dst;
+            p.len = len;
+            p.data.assign(data, data + len);
+            line.push(i);
+        }
+    };
+
+    auto print_stats = [&]() {
+        double sec = (now_us() - start) / 1e6;
+        const char* names[2] = {"client->server", "server->client"};
+        const DirStats* ds[2] = {&fwd.stats, &rev.stats};
+        for (int k = 0; k < 2; k++) {
+            const DirStats& s = *ds[k];
+            LOG("%s: rx=%llu tx=%llu lost=%llu queue_drops=%llu pool_drops=%llu too_big=%llu dup=%llu reordered=%llu",
+                names[k], (unsigned long long)s.rx, (unsigned long long)s.tx, (unsigned long long)s.lost,
+                (unsigned long long)s.queue_drops, (unsigned long long)s.pool_drops, (unsigned long long)s.too_big,
+                (unsigned long long)s.dups, (unsigned long long)s.reordered);
+        }
+        // CPU time, not wall time: on a shared core the relay is often preempted
+        uint64_t pkts = io.rx_pkts + io.tx_pkts;
+        double cpu = double(std::clock()) / CLOCKS_PER_SEC;
+        LOG("relay: %zu flows, %.1f s, %llu pkts in/out, cpu %.1f%%, %.0f ns/pkt, %.2f pkts/syscall",
+            flows.size(), sec, (unsigned long long)pkts, 100.0 * cpu / std::max(1e-9, sec),
+            pkts ? cpu * 1e9 / pkts : 0.0,
+            (io.rx_calls + io.tx_calls) ? double(pkts) / (io.rx_calls + io.tx_calls) : 0.0);
+    };
+
+    while (!g_stop) {
+        // ====== Sleep until a datagram arrives or the next packet is due ======
+        uint64_t t = now_us();
+        int64_t timeout = -1;
+        if (!line.empty()) timeout = pool[line.top()].due > t ? int64_t(pool[line.top()].due - t) : 0;
+        if (next_report != UINT64_MAX) {
+            int64_t r = next_report > t ? int64_t(next_report - t) : 0;
+            timeout = timeout < 0 ? r : std::min(timeout, r);
+        }
+        if (timeout != 0) wait_any(fds, timeout);
+
+        // ====== Ingress: drain every socket, a batch per syscall ======
+        for (size_t f = 0; f < fds.size(); f++) {
+            SOCKET s = fds[f].fd;
+            int nrx;
+            do {
+                nrx = recv_batch(s, rx, io);
+                t = now_us();
+                for (int i = 0; i < nrx; i++) {
+                    if (f == 0) {
+                        // client -> server through this client's upstream socket
+                        const sockaddr_in& from = rx.from[i];
+                        uint64_t key = ((uint64_t)from.sin_addr.s_addr << 16) | from.sin_port;
+                        auto it = flow_of.find(key);
+                        if (it == flow_of.end()) {
+                            if (flows.size() >= (size_t)NETEM_FLOWS) continue;
+                            Flow fl;
+                            fl.client = from;
+                            fl.up = open_socket(listen_ip, 0);
+                            flows.push_back(fl);
+                            it = flow_of.emplace(key, flows.size() - 1).first;
+                            pollfd pfd{};
+                            pfd.fd = fl.up;
+                            pfd.events = POLLIN;
+                            fds.push_back(pfd);
+                            LOG("new flow %u.%u.%u.%u:%u", ntohl(from.sin_addr.s_addr) >> 24,
+                                (ntohl(from.sin_addr.s_addr) >> 16) & 0xFF, (ntohl(from.sin_addr.s_addr) >> 8) & 0xFF,
+                                ntohl(from.sin_addr.s_addr) & 0xFF, ntohs(from.sin_port));
+                        }
+                        admit(fwd, flows[it->second].up, server, rx.slot(i), rx.len[i], t);
+                    } else {
+                        // server -> the client owning this upstream socket
+                        admit(rev, lsock, flows[f - 1].client, rx.slot(i), rx.len[i], t);
+                    }
+                }
+            } while (nrx == RDT_BATCH);
+        }
+
+        // ====== Egress: everything due, consecutive packets of one socket per call ======
+        t = now_us();
+        Pkt* batch[RDT_BATCH];
+        int batch_idx[RDT_BATCH];
+        int n = 0;
+        auto flush = [&]() {
+            if (n == 0) return;
+            int sent = send_raw_batch(batch[0]->sock, batch, n, io);
+            (batch[0]->sock == lsock ? rev : fwd).stats.tx += (uint64_t)sent;
+            for (int i = 0; i < n; i++) free_pkts.push_back(batch_idx[i]);
+            n = 0;
+        };
+        while (!line.empty() && pool[line.top()].due <= t) {
+            int i = line.top();
+            line.pop();
+            if (n > 0 && (n == RDT_BATCH || batch[0]->sock != pool[i].sock)) flush();
+            batch[n] = &pool[i];
+            batch_idx[n++] = i;
+        }
+        flush();
+
+        if (now_us() >= next_report) {
+            print_stats();
+            next_report += (uint64_t)(report * 1e6);
+        }
+    }
+
+    print_stats();
+    closesocket(lsock);
+    for (const Flow& fl : flows) closesocket(fl.up);
+    WSACleanup();
+    return 0;
+}
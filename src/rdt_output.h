@@ -0,0 +1,435 @@
+#pragma once
+// Receiver output file with positional writes.
+//
+// Payload is copied into fixed blocks that a writer thread writes at their
+// file offsets, so a slow disk never stalls the receive loop. Stripes of one
+// transfer share an OutputFd, each writing through its own OutputFile at its
+// base offset; a multi-file session writes through a SessionOutput, which
+// places stream offsets in the files of its manifest.
+#include "rdt.h"
+#include "rdt_ring.h"
+#include <memory>
+
+#ifdef _WIN32
+#include <io.h>
+#include <direct.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/utime.h>
+#else
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+
+static inline bool pwrite_all(int fd, const uint8_t* p, size_t n, uint64_t off) {
+#ifdef _WIN32
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    while (n > 0) {
+        OVERLAPPED ov{};
+        ov.Offset = (DWORD)off;
+        ov.OffsetHigh = (DWORD)(off >> 32);
+        DWORD w = 0;
+        if (!WriteFile(h, p, (DWORD)std::min<size_t>(n, 1u << 30), &w, &ov)) return false;
+        p += w; n -= w; off += w;
+    }
+#else
+    while (n > 0) {
+        ssize_t w = ::pwrite(fd, p, n, (off_t)off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w; n -= (size_t)w; off += (uint64_t)w;
+    }
+#endif
+    return true;
+}
+
+// The open file. Writes are positional, so writers at disjoint offsets
+// (stripes, possibly on different threads) need no lock.
+class OutputFd {
+public:
+    // In memory instead of a file (the simulator's output; one thread only).
+    OutputFd() {}
+
+    explicit OutputFd(const std::string& path) : path_(path) {
+#ifdef _WIN32
+        fd_ = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if (fd_ < 0) die("cannot open output file");
+    }
+
+    virtual ~OutputFd() { close_fd(); }
+
+    // Called by the writer thread.
+    virtual bool write(const uint8_t* p, size_t n, uint64_t off) {
+        if (fd_ >= 0) return pwrite_all(fd_, p, n, off);
+        if (mem_.size() < off + n) mem_.resize((size_t)(off + n));
+        std::memcpy(mem_.data() + off, p, n);
+        return true;
+    }
+
+    const std::vector<uint8_t>& memory() const { return mem_; }
+
+    // The transfer was abandoned: remove what it left behind. done is the
+    // stream offset everything below which was received (a session keeps
+    // the files that ended there). Only once no writer uses the file.
+    virtual void discard(uint64_t done) {
+        (void)done;
+        close_fd();
+        if (!path_.empty()) std::remove(path_.c_str());
+    }
+
+private:
+    OutputFd(const OutputFd&);
+    OutputFd& operator=(const OutputFd&);
+
+    void close_fd() {
+        if (fd_ < 0) return;
+#ifdef _WIN32
+        _close(fd_);
+#else
+        ::close(fd_);
+#endif
+        fd_ = -1;
+    }
+
+    std::string path_;
+    int fd_ = -1;
+    std::vector<uint8_t> mem_;
+};
+
+// ====== Multi-file session (framing in rdt.h) ======
+// The connection assembles the manifest itself (take(), protocol thread) and
+// hands only file bytes to the OutputFile; once the manifest is complete,
+// write() maps a stream offset to a file and the offset in it. Files are
+// opened by the writer thread on first use, one at a time (writes are
+// mostly in stream order), and truncated only on that first open. complete()
+// creates the empty files and applies mode and mtime after the last write.
+class SessionOutput : public OutputFd {
+public:
+    explicit SessionOutput(const std::string& dir) : dir_(dir) {}
+
+    ~SessionOutput() override { close_file(); }
+
+    const std::string& dir() const { return dir_; }
+    const std::vector<SessionFile>& files() const { return files_; }
+
+    // Stream offset of the first file byte: the manifest's end once it is
+    // complete, UINT64_MAX before.
+    uint64_t data_off() const { return ready_ ? mlen_ : UINT64_MAX; }
+
+    // Manifest bytes of a segment at stream offset off < data_off(). False if
+    // the segment also holds bytes past the manifest that cannot be placed
+    // yet: the manifest end is unknown (its prefix says) or the manifest is
+    // still incomplete. The caller then drops the segment.
+    bool take(uint64_t off, const uint8_t* p, size_t n) {
+        if (mlen_ == 0) {
+            uint64_t end = std::min<uint64_t>(off + n, SESSION_PREFIX);
+            if (off < end) {
+                buf_.resize(SESSION_PREFIX);
+                std::memcpy(buf_.data() + off, p, (size_t)(end - off));
+                have_.add((uint32_t)off, (uint32_t)end);
+            }
+            if (!have_.covers(0, SESSION_PREFIX)) return off + n <= SESSION_PREFIX;
+            mlen_ = manifest_length(buf_.data());
+            if (mlen_ == 0) {
+                // not a manifest: nothing of this stream can be placed
+                bad_ = true;
+                ready_ = true;
+                mlen_ = SESSION_PREFIX;
+                return true;
+            }
+            buf_.resize((size_t)mlen_);
+        }
+        uint64_t end = std::min<uint64_t>(off + n, mlen_);
+        if (off < end) {
+            std::memcpy(buf_.data() + off, p, (size_t)(end - off));
+            have_.add((uint32_t)off, (uint32_t)end);
+        }
+        if (have_.covers(0, (uint32_t)mlen_)) layout();
+        return off + n <= mlen_ || ready_;
+    }
+
+    bool write(const uint8_t* p, size_t n, uint64_t off) override {
+        // the last file holding off (empty files share their offset with the next)
+        size_t i = (size_t)(std::upper_bound(files_.begin(), files_.end(), off,
+                                             [](uint64_t o, const SessionFile& f) { return o < f.off; }) -
+                            files_.begin());
+        for (; n > 0 && i > 0 && i <= files_.size(); i++) {
+            const SessionFile& f = files_[i - 1];
+            if (f.size == 0) continue;
+            if (off >= f.off + f.size) break;   // past the last file: not ours to place
+            size_t k = (size_t)std::min<uint64_t>(n, f.off + f.size - off);
+            if (skip_[i - 1] == 0 && !open_file(i - 1)) skip_[i - 1] = 2;   // cannot create it
+            if (skip_[i - 1] == 0 && !pwrite_all(cur_fd_, p, k, off - f.off)) return false;
+            p += k; n -= k; off += k;
+        }
+        return true;
+    }
+
+    // After the last write: empty files created, metadata applied. Returns
+    // the files written (skipped() tells how many were refused).
+    size_t complete() {
+        close_file();
+        size_t done = 0;
+        for (size_t i = 0; i < files_.size(); i++) {
+            if (skip_[i]) continue;
+            std::string path = dir_ + "/" + files_[i].path;
+            if (!opened_[i]) {
+                if (!open_file(i)) {
+                    skip_[i] = 2;
+                    continue;
+                }
+                close_file();
+            }
+#ifdef _WIN32
+            _chmod(path.c_str(), (files_[i].mode & 0200) ? (_S_IREAD | _S_IWRITE) : _S_IREAD);
+            struct _utimbuf ut;
+            ut.actime = ut.modtime = (time_t)files_[i].mtime;
+            _utime(path.c_str(), &ut);
+#else
+            chmod(path.c_str(), (mode_t)(files_[i].mode & 0777));
+            struct utimbuf ut;
+            ut.actime = ut.modtime = (time_t)files_[i].mtime;
+            utime(path.c_str(), &ut);
+#endif
+            done++;
+        }
+        return done;
+    }
+
+    void discard(uint64_t done) override {
+        close_file();
+        for (size_t i = 0; i < files_.size(); i++) {
+            if (opened_[i] && files_[i].off + files_[i].size > done) std::remove((dir_ + "/" + files_[i].path).c_str());
+        }
+    }
+
+    size_t skipped() const {
+        size_t n = 0;
+        for (uint8_t s : skip_) n += s != 0;
+        return n;
+    }
+    bool bad() const { return bad_; }
+
+private:
+    // protocol thread, once: the file table the writer then only reads (the
+    // ring hand-off of the first block past the manifest publishes it)
+    void layout() {
+        ready_ = true;
+        bad_ = !parse_manifest(buf_.data(), buf_.size(), files_);
+        if (bad_) files_.clear();
+        skip_.assign(files_.size(), 0);
+        opened_.assign(files_.size(), 0);
+        for (size_t i = 0; i < files_.size(); i++) skip_[i] = !session_path_ok(files_[i].path);
+        make_dirs(dir_ + "/");
+        buf_.clear();
+        buf_.shrink_to_fit();
+    }
+
+    // every directory on the way to path (its last component is a file name)
+    static void make_dirs(const std::string& path) {
+        for (size_t i = path.find('/', 1); i != std::string::npos; i = path.find('/', i + 1)) {
+            std::string d = path.substr(0, i);
+#ifdef _WIN32
+            _mkdir(d.c_str());
+#else
+            mkdir(d.c_str(), 0755);
+#endif
+        }
+    }
+
+    bool open_file(size_t i) {
+        if (cur_fd_ >= 0 && cur_ == i) return true;
+        close_file();
+        std::string path = dir_ + "/" + files_[i].path;
+        int flags = opened_[i] ? 0 : O_CREAT | O_TRUNC;
+        if (!opened_[i]) make_dirs(path);
+#ifdef _WIN32
+        cur_fd_ = _open(path.c_str(), _O_WRONLY | _O_BINARY | flags, _S_IREAD | _S_IWRITE);
+#else
+        cur_fd_ = ::open(path.c_str(), O_WRONLY | flags, 0644);
+#endif
+        if (cur_fd_ < 0) return false;
+        opened_[i] = 1;
+        cur_ = i;
+        return true;
+    }
+
+    void close_file() {
+        if (cur_fd_ < 0) return;
+#ifdef _WIN32
+        _close(cur_fd_);
+#else
+        ::close(cur_fd_);
+#endif
+        cur_fd_ = -1;
+    }
+
+    std::string dir_;
+
+    // protocol thread: manifest assembly
+    std::vector<uint8_t> buf_;
+    RangeSet have_;            // manifest bytes received (offsets < SESSION_MAX_MANIFEST)
+    uint64_t mlen_ = 0;        // 0: prefix not complete yet
+    bool ready_ = false;
+    bool bad_ = false;
+
+    std::vector<SessionFile> files_;
+    std::vector<uint8_t> skip_;     // 1: unsafe path, 2: cannot be created; bytes discarded
+
+    // writer thread (protocol thread in complete(), once the writer is idle)
+    std::vector<uint8_t> opened_;
+    int cur_fd_ = -1;   // file cur_ (the only one open)
+    size_t cur_ = 0;
+};
+
+// ====== Writer thread ======
+// The protocol thread copies payload into fixed blocks and hands full blocks
+// to a writer thread through an SpscRing; the writer pwrite()s them and
+// returns them on a second ring. A block holds extents (file offset, length):
+// contiguous bytes extend the last extent, anything else starts a new one, so
+// in-order data and scattered out-of-order segments pack densely alike.
+//
+// When every block is queued for disk, write() refuses the segment instead
+// of blocking; room() shrinks first, so the receiver advertises a smaller
+// window before that happens. Under the simulator (virtual_net()) there is
+// no thread: flush() writes the block itself, so runs replay exactly.
+class OutputFile {
+public:
+    static constexpr size_t BLOCK = 64 * 1024;
+    static constexpr size_t EXTENTS = 128;     // per block
+    static constexpr size_t MAX_BLOCKS = 1024; // 64 MB per connection
+
+    explicit OutputFile(const std::string& path, uint64_t window = 0)
+        : OutputFile(std::make_shared<OutputFd>(path), 0, window) {}
+
+    // Stream offset 0 maps to file offset base. The pool holds two windows.
+    OutputFile(std::shared_ptr<OutputFd> file, uint64_t base, uint64_t window = 0)
+        : file_(std::move(file)), base_(base),
+          nblocks_((size_t)std::max<uint64_t>(4, std::min<uint64_t>(MAX_BLOCKS, 2 * window / BLOCK + 2))),
+          blocks_(nblocks_), full_(nblocks_), free_(nblocks_) {
+        for (size_t i = 0; i < nblocks_; i++) {
+            blocks_[i].data.resize(BLOCK);
+            blocks_[i].ext.reserve(EXTENTS);
+            free_.push((uint32_t)i);
+        }
+        if (!virtual_net()) writer_ = std::thread(&OutputFile::writer, this);
+    }
+
+    ~OutputFile() {
+        flush();
+        if (!writer_.joinable()) return;
+        stop_.store(true);
+        waker_.wake();
+        writer_.join();
+    }
+
+    // Bytes at stream offset off. False if no block is free: nothing is
+    // lost (a partially copied segment is simply written again when the
+    // sender retransmits it), the caller just must not count it received.
+    bool write(uint64_t off, const uint8_t* p, size_t n) {
+        while (n > 0) {
+            if (cur_ < 0) {
+                uint32_t b;
+                if (!free_.pop(b)) { stalls_++; return false; }
+                cur_ = (int)b;
+            }
+            Block& blk = blocks_[cur_];
+            size_t k = std::min(n, BLOCK - blk.used);
+            bool extend = !blk.ext.empty() && blk.ext.back().off + blk.ext.back().len == base_ + off;
+            if (!extend && blk.ext.size() == EXTENTS) { flush(); continue; }
+            std::memcpy(blk.data.data() + blk.used, p, k);
+            if (extend) blk.ext.back().len += (uint32_t)k;
+            else blk.ext.push_back(Extent{base_ + off, (uint32_t)k});
+            blk.used += k;
+            p += k; n -= k; off += k;
+            if (blk.used == BLOCK) flush();
+        }
+        return true;
+    }
+
+    // Hand the partly filled block to the writer (does not wait for it).
+    void flush() {
+        if (cur_ < 0 || blocks_[cur_].used == 0) return;
+        if (!writer_.joinable()) {
+            write_block((uint32_t)cur_);
+            cur_ = -1;
+            return;
+        }
+        full_.push((uint32_t)cur_);   // never full: it holds every block at most
+        cur_ = -1;
+        waker_.wake();
+    }
+
+    // Bytes write() can take right now without waiting for the disk.
+    uint64_t room() const {
+        uint64_t r = (uint64_t)free_.size() * BLOCK;
+        if (cur_ >= 0) r += BLOCK - blocks_[cur_].used;
+        return r;
+    }
+
+    // Everything handed over has reached the file.
+    bool idle() const { return cur_ < 0 && free_.size() == nblocks_; }
+
+    // Full blocks still on their way to the file: room() grows without another write().
+    bool writing() const { return free_.size() + (cur_ >= 0 ? 1 : 0) < nblocks_; }
+
+    // room() with every block free.
+    uint64_t capacity() const { return (uint64_t)nblocks_ * BLOCK; }
+
+    uint64_t writes() const { return writes_.load(); }
+    uint64_t bytes() const { return bytes_.load(); }
+    uint64_t stalls() const { return stalls_; }
+
+private:
+    struct Extent {
+        uint64_t off;   // file offset
+        uint32_t len;
+    };
+    struct Block {
+        std::vector<uint8_t> data;
+        size_t used = 0;
+        std::vector<Extent> ext;
+    };
+
+    void writer() {
+        for (;;) {
+            waker_.wait([this] { return !full_.empty() || stop_.load(); });
+            uint32_t b;
+            while (full_.pop(b)) write_block(b);
+            if (stop_.load() && full_.empty()) return;
+        }
+    }
+
+    // every extent at its file offset, then the block is free again
+    void write_block(uint32_t b) {
+        Block& blk = blocks_[b];
+        size_t pos = 0;
+        for (const Extent& e : blk.ext) {
+            if (!file_->write(blk.data.data() + pos, e.len, e.off)) die("write output file");
+            pos += e.len;
+            writes_.fetch_add(1, std::memory_order_relaxed);
+            bytes_.fetch_add(e.len, std::memory_order_relaxed);
+        }
+        blk.used = 0;
+        blk.ext.clear();
+        free_.push(b);
+    }
+
+    std::shared_ptr<OutputFd> file_;
+    uint64_t base_;
+    size_t nblocks_;
+    std::vector<Block> blocks_;
+    SpscRing<uint32_t> full_;   // protocol -> writer
+    SpscRing<uint32_t> free_;   // writer -> protocol
+    int cur_ = -1;              // block being filled (protocol thread)
+    uint64_t stalls_ = 0;       // segments refused for lack of a block
+    std::atomic<uint64_t> writes_{0}, bytes_{0};
+    std::atomic<bool> stop_{false};
+    Waker waker_;
+    std::thread writer_;
+};
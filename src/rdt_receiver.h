@@ -0,0 +1,665 @@
+#pragma once
+// Receiving side of one connection: the R_CLOSED -> R_SYN_RCVD -> R_EST ->
+// R_FIN_WAIT state machine, out-of-order ranges, ACK policy and output file.
+//
+// A connection never reads the socket: the event loop (receiver.cpp) drains
+// datagrams, finds the connection by peer address + conn ID and hands each
+// packet to on_packet(). ACKs generated during a burst are staged and leave
+// in one batched send at flush(); timers run from on_timer(). Payload goes to
+// the OutputFile's writer thread; the window we advertise is what its buffer
+// pool can still take, in segments of the MSS agreed in the handshake.
+// A multi-file session writes through a SessionOutput: the connection feeds
+// it the manifest and the stream bytes after it land in the listed files.
+// With FEC (rdt_fec.h) a parity segment can fill a hole before the sender
+// learns of it: the ACK for data beyond a hole is held until that parity has
+// been tried.
+#include "rdt.h"
+#include "rdt_fec.h"
+#include "rdt_output.h"
+#include <deque>
+#include <functional>
+
+struct ReceiverConfig {
+    int fixed_wnd = 1;             // segments of the agreed MSS
+    int mss = RDT_MAX_MSS;         // largest segment payload we take (offered in the SYN|ACK)
+    int ack_every = RDT_ACK_EVERY;
+    int delack_ms = RDT_DELACK_MS;
+    bool fastopen = true;          // issue cookies and take data in a SYN that carries a valid one
+    uint64_t cookie_key[2] = {0, 0};   // cookie secret (receiver.cpp draws it at startup)
+    bool fec = true;               // rebuild lost segments from parity if the sender offers it
+};
+
+// Creates a connection's output once its handshake completes, so a SYN alone
+// allocates neither a file nor a writer: the file, a stripe's shared file or
+// a session directory.
+typedef std::function<std::shared_ptr<OutputFd>()> OpenOutput;
+
+// ====== SACK blocks from the out-of-order ranges ======
+// Out-of-order payload is already written at its file offset, so the receiver
+// only tracks which byte ranges beyond expected_ack have arrived (RangeSet).
+// As in RFC 2018 the first block is the one holding the most recently received
+// segment; the rest follow in sequence order. Cost is O(blocks), not O(window).
+static inline void build_sack_blocks(const RangeSet& ooo, uint32_t recent, RdtOptions& opt) {
+    opt.nsack = 0;
+    if (ooo.empty()) return;
+    size_t first = ooo.lower(recent);
+    if (first >= ooo.size() || ooo[first].start > recent) first = 0;
+    opt.sack[opt.nsack++] = ooo[first];
+    for (size_t i = 0; i < ooo.size() && opt.nsack < RDT_SACK_BLOCKS; i++) {
+        if (i != first) opt.sack[opt.nsack++] = ooo[i];
+    }
+}
+
+class RecvConnection {
+public:
+    // sock is shared with the other connections of the same worker; io
+    // collects that worker's syscall statistics. The stream is written to
+    // the file open() returns at file_off onward (non-zero for a stripe), or
+    // into the files of a session when that is a SessionOutput. tag prefixes
+    // every log line.
+    RecvConnection(SOCKET sock, const sockaddr_in& peer, uint16_t conn, OpenOutput open,
+                   uint64_t file_off, const ReceiverConfig& cfg, IoStats& io, const std::string& tag)
+        : sock_(sock), peer_(peer), conn_(conn), cfg_(cfg), io_(io), tag_(tag),
+          isn_recv_(rdt_isn()), open_(std::move(open)), file_off_(file_off),
+          adv_wnd_(wnd_field((uint32_t)cfg.fixed_wnd, 0)) {}
+
+    bool closed() const { return closed_; }
+    // closed because the peer went silent: what was written is incomplete
+    bool aborted() const { return aborted_; }
+    // stream offset below which everything was received
+    uint64_t received() const { return expected_off_; }
+
+    // Earliest time on_timer() has work to do (UINT64_MAX: none).
+    uint64_t deadline() const {
+        uint64_t d = delack_at_;
+        if (state_ == R_FIN_WAIT) d = std::min(d, fin_last_ + rto_.rto());
+        if (state_ == R_SYN_RCVD && !syn_data_.empty()) d = std::min(d, synack_sent_ + rto_.rto());
+        if (state_ == R_SYN_RCVD || state_ == R_EST) d = std::min(d, last_rx_ + uint64_t(RDT_IDLE_MS) * 1000);
+        if (!fec_pending_.empty()) d = std::min(d, fec_pending_.front().at_us + rto_.rto());
+        // the writer thread cannot wake us: poll it while it may reopen a
+        // shrunk window or the last blocks are still on their way to disk
+        if (closing_ || (state_ == R_EST && wnd_segs_ < max_wnd() && (out_->writing() || wnd_update_due())))
+            d = std::min(d, now_us() + RDT_DISK_POLL_US);
+        return d;
+    }
+
+    // ACKs staged by on_packet() leave in one batched send.
+    void flush() {
+        if (acks_.n > 0) flush_batch(sock_, peer_, acks_, io_);
+    }
+
+    void on_packet(const RdtHeader& h, const RdtOptions& opt, const uint8_t* payload) {
+        if (closed_ || closing_) return;
+        last_rx_ = now_us();
+
+        if (state_ == R_CLOSED) {
+            if (h.flags & F_SYN) {
+                sender_isn_ = h.seq;
+                expected_ack_ = sender_isn_ + 1;
+                expected_off_ = 0;
+                ooo_.clear();
+                // the MSS is answered only if offered; the window counts segments of it
+                if (opt.mss >= 0) {
+                    offer_mss_ = true;
+                    mss_ = std::max(1, std::min(cfg_.mss, opt.mss));
+                }
+                cfg_.fixed_wnd = std::min<int>(cfg_.fixed_wnd, (int)max_wnd_for(mss_));
+                adv_wnd_ = wnd_field((uint32_t)cfg_.fixed_wnd, 0);
+                if (opt.wscale >= 0) my_shift_ = wscale_for((uint32_t)cfg_.fixed_wnd);
+                // fast open: a valid cookie lets the SYN's payload in (acknowledged
+                // by the SYN|ACK, written once the handshake completes); a request
+                // or an invalid cookie is answered with our cookie
+                if (cfg_.fastopen && opt.tfo >= 0) {
+                    uint64_t c = fastopen_cookie(cfg_.cookie_key, peer_);
+                    bool valid = opt.tfo == 1 && opt.cookie == c;
+                    if (!valid) issue_cookie_ = c;
+                    if (valid && h.len > 0) {
+                        syn_data_.assign(payload, payload + h.len);
+                        expected_ack_ += h.len;
+                        expected_off_ = h.len;
+                    }
+                    log("Fast open: %s%s", opt.tfo == 0 ? "cookie requested" : valid ? "cookie valid" : "cookie invalid",
+                        !valid ? ", cookie issued" : syn_data_.empty() ? "" : ", SYN data held until the handshake completes");
+                }
+                // FEC: the sender leaves DATA room for OPT_FEC, too much of a small
+                // segment. The ring is allocated once the handshake completes.
+                if (cfg_.fec && opt.fec && mss_ > 4 * FEC_OPT_ROOM) {
+                    fec_on_ = true;
+                    fec_last_ = expected_ack_;
+                }
+                session_files_ = opt.session;
+                state_ = R_SYN_RCVD;
+
+                send_synack();
+                log("RX SYN(seq=%u) -> TX SYN|ACK(seq=%u, ack=%u) wscale=%d mss=%d",
+                    sender_isn_, isn_recv_, expected_ack_, my_shift_, mss_);
+                if (fec_on_) log("FEC: parity accepted");
+            }
+            return;
+        }
+
+        if (state_ == R_SYN_RCVD) {
+            if (h.flags & F_SYN) {
+                // our SYN|ACK was lost and the sender retransmitted its SYN
+                if (h.seq == sender_isn_) send_synack();
+                return;
+            }
+            // DATA/FIN/probes also mean the sender saw our SYN|ACK (its final ACK was lost)
+            bool final_ack = (h.flags & F_ACK) && h.ack == (isn_recv_ + 1);
+            if (!final_ack && !(h.flags & (F_DATA | F_FIN | F_PROBE | F_FEC))) return;
+            state_ = R_EST;
+            start_ms_ = now_ms();
+            if (synack_retx_ == 0 && final_ack) rto_.on_sample(int64_t(now_us() - synack_sent_));
+            if (my_shift_ >= 0) adv_wnd_ = wnd_field((uint32_t)cfg_.fixed_wnd, my_shift_);
+            // the buffer pool holds two windows
+            file_ = open_();
+            session_ = dynamic_cast<SessionOutput*>(file_.get());
+            out_.reset(new OutputFile(file_, file_off_, (uint64_t)cfg_.fixed_wnd * mss_));
+            if (fec_on_) fec_grow(std::min(mss_, RDT_MSS));   // a probing sender starts there
+            if (!syn_data_.empty()) {
+                // the pool is still empty: the SYN's payload always fits
+                store(0, syn_data_.data(), syn_data_.size());
+                log("Connection established (%zu bytes of SYN data).", syn_data_.size());
+                std::vector<uint8_t>().swap(syn_data_);
+            } else {
+                log("Connection established.");
+            }
+            if (session_) log("Session of %lld files into %s/", (long long)session_files_, session_->dir().c_str());
+            if (!(h.flags & (F_DATA | F_FIN | F_PROBE | F_FEC))) return;
+        }
+
+        if (state_ == R_EST) {
+            if (h.flags & F_FIN) {
+                // the FIN's ACK covers any delayed ACK
+                unacked_segs_ = 0;
+                delack_at_ = UINT64_MAX;
+                flush();
+
+                out_->flush();
+
+                // ACK peer FIN
+                send_ack(h.seq + 1);
+                log("RX FIN(seq=%u) -> TX ACK(ack=%u)", h.seq, h.seq + 1);
+
+                // send our FIN
+                send_fin();
+                log("TX FIN(seq=%u, ack=%u)", isn_recv_ + 2, expected_ack_);
+
+                state_ = R_FIN_WAIT;
+                return;
+            }
+
+            if (h.flags & F_DATA) {
+                on_data(h, payload);
+                if (!fec_wait_.empty()) fec_retry();
+            } else if (h.flags & F_FEC) {
+                on_parity(h, opt, payload);
+            } else if (h.flags & F_PROBE) {
+                // path MTU probe: it arrived whole, tell the sender its size
+                probe_echo_ = h.len;
+                queue_ack();
+            } else if (h.flags & F_ACK) {
+                queue_ack();   // window probe: answer with our window
+            }
+        } else if (state_ == R_FIN_WAIT) {
+            if (h.flags & F_ACK) {
+                log("Connection closed. Receive time = %.3f s", (now_ms() - start_ms_) / 1000.0);
+                close();
+            } else if (h.flags & F_FIN) {
+                // our ACK of the peer FIN was lost; the peer retransmitted its FIN
+                send_ack(h.seq + 1);
+            }
+        }
+    }
+
+    void on_timer(uint64_t t) {
+        if (closed_) return;
+        if (closing_) {
+            if (!out_ || out_->idle()) finish();
+            return;
+        }
+
+        // ====== Idle: the sender crashed, or the SYN was stray ======
+        // Its output (incomplete) is left to the event loop to remove.
+        if ((state_ == R_SYN_RCVD || state_ == R_EST) && t - last_rx_ >= uint64_t(RDT_IDLE_MS) * 1000) {
+            log("No packet for %d s, connection dropped%s", RDT_IDLE_MS / 1000,
+                out_ ? " (partial output removed)" : "");
+            aborted_ = closed_ = true;
+            return;
+        }
+
+        // ====== Fast open: SYN|ACK retransmission while SYN data waits ======
+        // A replayed SYN never completes the handshake (it cannot ACK our
+        // fresh ISN), so its data is dropped without reaching the file.
+        if (state_ == R_SYN_RCVD && !syn_data_.empty() && t - synack_sent_ >= rto_.rto()) {
+            if (synack_retx_ >= RDT_MAX_RETX) {
+                log("Fast open: handshake not completed after %d SYN|ACKs, %zu bytes of SYN data dropped",
+                    synack_retx_ + 1, syn_data_.size());
+                close();
+                return;
+            }
+            rto_.on_timeout();
+            send_synack();
+        }
+
+        if (!fec_pending_.empty()) fec_confirm(t);
+
+        // ====== Window update once the writer has freed enough blocks ======
+        if (state_ == R_EST && wnd_update_due()) {
+            queue_ack();
+            flush();
+            wnd_updates_++;
+        }
+
+        // ====== Delayed ACK timer ======
+        if (delack_at_ != UINT64_MAX && t >= delack_at_) {
+            queue_ack();
+            flush();
+        }
+
+        // ====== FIN retransmission ======
+        if (state_ == R_FIN_WAIT && t - fin_last_ >= rto_.rto()) {
+            if (fin_retx_++ >= RDT_MAX_RETX) {
+                // peer is gone (its final ACK never arrived); all data is already on disk
+                log("FIN not acked after %d retries, closing.", RDT_MAX_RETX);
+                close();
+                return;
+            }
+            rto_.on_timeout();
+            send_fin();
+            log("RETX FIN(seq=%u) retx=%d rto=%.1f ms", isn_recv_ + 2, fin_retx_, rto_.rto() / 1000.0);
+        }
+    }
+
+private:
+    enum State { R_CLOSED, R_SYN_RCVD, R_EST, R_FIN_WAIT };
+
+    void log(const char* fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        vlog(tag_.c_str(), fmt, ap);
+        va_end(ap);
+    }
+
+    void on_data(const RdtHeader& h, const uint8_t* payload) {
+        data_segs_++;
+        bool late = false;
+        if (fec_on_) {
+            fec_grow(h.len);
+            late = !fec_pending_.empty() && fec_late(h.seq);
+        }
+        // ACK at once on anything the sender must react to quickly:
+        // out-of-order arrival, a (partially) filled hole, a duplicate
+        bool ack_now = false;
+        if (h.seq == expected_ack_) {
+            if (!store(expected_off_, payload, h.len)) {
+                // writer is behind: drop it, the ACK shows the closed window
+                queue_ack();
+                return;
+            }
+            expected_ack_ += h.len;
+            expected_off_ += h.len;
+
+            // hole filled: buffered segments are already on disk, just advance
+            if (!ooo_.empty()) {
+                ack_now = true;
+                uint32_t next = ooo_.advance(expected_ack_);
+                expected_off_ += next - expected_ack_;
+                expected_ack_ = next;
+            }
+        } else if (seq_gt(h.seq, expected_ack_)) {
+            uint32_t max_seq = expected_ack_ + (uint32_t)cfg_.fixed_wnd * (uint32_t)mss_;
+            if (ooo_.covers(h.seq, h.seq + h.len)) {
+                if (fec_on_ && !late) fec_dup_++;
+            } else if (seq_lt(h.seq, max_seq) && store(expected_off_ + (h.seq - expected_ack_), payload, h.len)) {
+                ooo_.add(h.seq, h.seq + h.len);
+            }
+            sack_recent_ = h.seq;
+            // with FEC the block's parity may fill the hole: its SACK would
+            // start a fast retransmit, so the ACK waits for that parity (or
+            // the delayed-ACK timer)
+            if (fec_active()) fec_hold_ = true;
+            else ack_now = true;
+        } else {
+            // duplicate old segment; ignore payload (our ACK was probably lost)
+            ack_now = true;
+            if (fec_on_ && !late) fec_dup_++;
+        }
+
+        // send ACK + SACK, or hold it for the next segment / delayed-ACK timer
+        if (ack_now || (!fec_hold_ && ++unacked_segs_ >= cfg_.ack_every)) {
+            queue_ack();
+        } else if (delack_at_ == UINT64_MAX) {
+            delack_at_ = now_us() + (uint64_t)cfg_.delack_ms * 1000;
+        }
+    }
+
+    // Payload at stream offset off to the output. A session's manifest bytes
+    // go to the SessionOutput; false if the segment cannot be placed yet (no
+    // free block, or file bytes ahead of an incomplete manifest).
+    bool store(uint64_t off, const uint8_t* p, size_t n) {
+        if (fec_on_) fec_ring_.keep(off, p, n);
+        if (session_ && off < session_->data_off()) {
+            if (!session_->take(off, p, n)) return false;
+            size_t k = (size_t)std::min<uint64_t>(n, session_->data_off() - off);
+            p += k; n -= k; off += k;
+        }
+        return n == 0 || out_->write(off, p, n);
+    }
+
+    // ====== FEC: rebuild a lost segment from its block's parity ======
+    void on_parity(const RdtHeader& h, const RdtOptions& opt, const uint8_t* payload) {
+        fec_parity_++;
+        if (!fec_on_ || opt.fec_n == 0) return;
+        uint32_t end = h.seq;
+        for (int i = 0; i < opt.fec_n; i++) {
+            if (opt.fec_len[i] > h.len) return;   // malformed: the parity is as long as its longest segment
+            end += opt.fec_len[i];
+        }
+        if (seq_gt(end, fec_last_)) fec_last_ = end;
+        if (seq_leq(end, expected_ack_)) return;   // nothing of the block is missing any more
+        fec_wait_.emplace_back();
+        FecBlock& b = fec_wait_.back();
+        b.seq = h.seq;
+        b.n = opt.fec_n;
+        std::copy(opt.fec_len, opt.fec_len + opt.fec_n, b.len);
+        b.parity.assign(payload, payload + h.len);
+        if (fec_wait_.size() > FEC_WAIT) fec_wait_.pop_front();
+        fec_retry();
+        // the block past the first hole is decided: the held ACK goes now
+        if (fec_hold_ && seq_gt(end, expected_ack_)) queue_ack();
+    }
+
+    // Parity is flowing: the latest one covered data close to the first
+    // hole. (A sender in auto mode sends none while it sees no loss; an ACK
+    // held for a parity that never comes only delays its recovery.)
+    bool fec_active() const {
+        return fec_on_ && seq_geq(fec_last_ + 2u * RDT_FEC_MAX_K * (uint32_t)fec_seg_, expected_ack_);
+    }
+
+    // The ring holds a window of the largest segment seen so far: it grows
+    // as path MTU probing raises the segment size, within the output pool.
+    void fec_grow(int seg) {
+        if (seg <= fec_seg_) return;
+        fec_seg_ = seg;
+        uint64_t wnd = std::min<uint64_t>((uint64_t)(cfg_.fixed_wnd + 1) * (uint64_t)seg,
+                                          OutputFile::MAX_BLOCKS * OutputFile::BLOCK);
+        fec_ring_.reserve((size_t)wnd + (size_t)RDT_FEC_MAX_K * (size_t)seg);
+    }
+
+    // The original (or the retransmission) of a rebuilt segment arrived:
+    // it was late, not lost, or the sender counts it as lost itself.
+    bool fec_late(uint32_t seq) {
+        for (auto it = fec_pending_.begin(); it != fec_pending_.end(); ++it) {
+            if (it->seq != seq) continue;
+            fec_pending_.erase(it);
+            fec_late_++;
+            return true;
+        }
+        return false;
+    }
+
+    // Rebuilt segments whose original has not come within an RTO were lost:
+    // only those reach the sender's loss estimate (OPT_FEC_ACK).
+    void fec_confirm(uint64_t t) {
+        while (!fec_pending_.empty() && t - fec_pending_.front().at_us >= rto_.rto()) {
+            fec_pending_.pop_front();
+            fec_rebuilt_++;
+        }
+    }
+
+    bool fec_have(uint32_t s, uint32_t e) const {
+        return seq_leq(e, expected_ack_) || (seq_geq(s, expected_ack_) && ooo_.covers(s, e));
+    }
+
+    enum { FEC_DONE, FEC_REBUILT, FEC_WAITING };
+
+    // FEC_DONE: the block is complete (or beyond help), FEC_REBUILT: its one
+    // missing segment was rebuilt, FEC_WAITING: more than one is missing
+    int fec_rebuild(const FecBlock& b) {
+        int missing = -1;
+        uint32_t s = b.seq, mseq = 0;
+        for (int i = 0; i < b.n; s += b.len[i], i++) {
+            if (fec_have(s, s + b.len[i])) continue;
+            if (missing >= 0) return FEC_WAITING;
+            missing = i;
+            mseq = s;
+        }
+        if (missing < 0 || seq_lt(mseq, expected_ack_)) return FEC_DONE;
+        uint64_t off = expected_off_ + (uint64_t)(int64_t)(int32_t)(b.seq - expected_ack_);
+        if (!fec_ring_.holds(off)) return FEC_DONE;
+
+        fec_buf_.assign(b.parity.begin(), b.parity.end());
+        for (int i = 0; i < b.n; off += b.len[i], i++) {
+            if (i != missing) fec_ring_.fold(off, b.len[i], fec_buf_.data());
+        }
+        RdtHeader dh{};
+        dh.seq = mseq;
+        dh.flags = F_DATA;
+        dh.len = b.len[missing];
+        on_data(dh, fec_buf_.data());
+        // the writer may have had no room for it: try again later
+        if (!fec_have(mseq, mseq + dh.len)) return FEC_WAITING;
+        FecRebuilt r;
+        r.seq = mseq;
+        r.at_us = now_us();
+        fec_pending_.push_back(r);
+        return FEC_REBUILT;
+    }
+
+    // Try every waiting parity until none makes progress (a rebuilt segment
+    // can leave another block with a single hole).
+    void fec_retry() {
+        for (bool progress = true; progress;) {
+            progress = false;
+            for (size_t i = 0; i < fec_wait_.size();) {
+                int r = fec_rebuild(fec_wait_[i]);
+                if (r == FEC_WAITING) {
+                    i++;
+                    continue;
+                }
+                fec_wait_.erase(fec_wait_.begin() + (long)i);
+                progress |= r == FEC_REBUILT;
+            }
+        }
+    }
+
+    void send_synack() {
+        RdtHeader synack{};
+        synack.seq = isn_recv_;
+        synack.ack = expected_ack_;
+        synack.flags = F_SYN | F_ACK;
+        synack.wnd = adv_wnd_;   // never scaled in SYN|ACK
+        synack.len = 0;
+        synack.conn = conn_;
+        RdtOptions so;
+        if (offer_mss_) so.mss = mss_;
+        so.wscale = my_shift_;
+        if (issue_cookie_ != 0) {
+            so.tfo = 1;
+            so.cookie = issue_cookie_;
+        }
+        so.fec = fec_on_;
+        send_pkt(sock_, peer_, synack, nullptr, RDT_NO_PSUM, &so);
+        if (synack_sent_ != 0) synack_retx_++;
+        synack_sent_ = now_us();
+    }
+
+    // ====== FIN state (our FIN is retransmitted until the peer ACKs it) ======
+    void send_fin() {
+        RdtHeader fin{};
+        fin.seq = isn_recv_ + 2;
+        fin.ack = expected_ack_;
+        fin.flags = F_FIN | F_ACK;
+        fin.wnd = adv_wnd_;
+        fin.len = 0;
+        fin.conn = conn_;
+        send_pkt(sock_, peer_, fin, nullptr);
+        fin_last_ = now_us();
+    }
+
+    // immediate ACK of a FIN
+    void send_ack(uint32_t ackno) {
+        RdtHeader ack{};
+        ack.seq = isn_recv_ + 1;
+        ack.ack = ackno;
+        ack.flags = F_ACK;
+        ack.wnd = adv_wnd_;
+        ack.len = 0;
+        ack.conn = conn_;
+        send_pkt(sock_, peer_, ack, nullptr);
+    }
+
+    // Segments the output pool can take (flow control follows the disk).
+    uint32_t free_wnd() const {
+        return (uint32_t)std::min<uint64_t>((uint64_t)cfg_.fixed_wnd, out_->room() / (uint64_t)mss_);
+    }
+
+    // The window with every block free: fixed_wnd, or less if fixed_wnd
+    // segments of the MSS do not fit in the pool.
+    uint32_t max_wnd() const {
+        return (uint32_t)std::min<uint64_t>((uint64_t)cfg_.fixed_wnd, out_->capacity() / (uint64_t)mss_);
+    }
+
+    // The writer has freed enough blocks to advertise more (silly-window
+    // avoidance: reopen by half a window, or fully).
+    bool wnd_update_due() const {
+        uint32_t full = max_wnd(), w = free_wnd();
+        if (wnd_segs_ >= full || w <= wnd_segs_) return false;
+        return wnd_segs_ == 0 || w == full || w - wnd_segs_ >= std::max(1u, full / 2);
+    }
+
+    // cumulative ACK + SACK for everything received so far (staged, flushed per burst)
+    void queue_ack() {
+        wnd_segs_ = free_wnd();
+        adv_wnd_ = wnd_field(wnd_segs_, std::max(0, my_shift_));
+        if (wnd_segs_ < min_wnd_) min_wnd_ = wnd_segs_;
+
+        RdtHeader ack{};
+        ack.seq = isn_recv_ + 1;
+        ack.ack = expected_ack_;
+        ack.flags = F_ACK;
+        ack.wnd = adv_wnd_;
+        ack.len = 0;
+        ack.conn = conn_;
+        RdtOptions opt;
+        build_sack_blocks(ooo_, sack_recent_, opt);
+        opt.pmtu = probe_echo_;
+        probe_echo_ = -1;
+        if (!fec_pending_.empty()) fec_confirm(now_us());
+        if (fec_rebuilt_ > 0 || fec_dup_ > 0) {
+            opt.fec_rebuilt = (int64_t)fec_rebuilt_;
+            opt.fec_dup = (uint32_t)fec_dup_;
+        }
+        acks_.add(ack, nullptr, RDT_NO_PSUM, &opt);
+        if (acks_.full()) flush();
+        unacked_segs_ = 0;
+        delack_at_ = UINT64_MAX;
+        fec_hold_ = false;
+        acks_sent_++;
+    }
+
+    // Hand the last blocks to the writer; finish() once they are on disk.
+    void close() {
+        closing_ = true;
+        if (out_) out_->flush();
+    }
+
+    void finish() {
+        closed_ = true;
+        log("ACKs: %llu for %llu DATA segments (%.2f segments/ACK)",
+            (unsigned long long)acks_sent_, (unsigned long long)data_segs_,
+            acks_sent_ ? double(data_segs_) / acks_sent_ : 0.0);
+        if (!out_) return;   // never established
+        log("Disk: %llu bytes in %llu writes (%.1f KB/write)",
+            (unsigned long long)out_->bytes(), (unsigned long long)out_->writes(),
+            out_->writes() ? out_->bytes() / 1024.0 / out_->writes() : 0.0);
+        log("Disk backpressure: min window=%u segments, %llu window updates, %llu segments refused",
+            std::min(min_wnd_, (uint32_t)cfg_.fixed_wnd), (unsigned long long)wnd_updates_, (unsigned long long)out_->stalls());
+        if (fec_on_) {
+            fec_rebuilt_ += fec_pending_.size();
+            fec_pending_.clear();
+            log("FEC: %llu parity segments, %llu lost segments rebuilt from them (%llu more arrived late)",
+                (unsigned long long)fec_parity_, (unsigned long long)fec_rebuilt_, (unsigned long long)fec_late_);
+        }
+        if (session_) {
+            uint64_t bytes = 0;
+            for (const SessionFile& f : session_->files()) bytes += f.size;
+            size_t written = session_->complete();
+            log("Session: %zu of %zu files (%llu bytes) written to %s/, %zu refused%s", written,
+                session_->files().size(), (unsigned long long)bytes, session_->dir().c_str(),
+                session_->skipped(), session_->bad() ? " (malformed manifest)" : "");
+        }
+    }
+
+    SOCKET sock_;
+    sockaddr_in peer_;
+    uint16_t conn_;
+    ReceiverConfig cfg_;
+    IoStats& io_;
+    std::string tag_;
+
+    State state_ = R_CLOSED;
+    bool closing_ = false;         // waiting for the writer to drain
+    bool closed_ = false;
+    bool aborted_ = false;
+    uint64_t last_rx_ = 0;         // when the last packet arrived (idle timeout)
+    uint32_t isn_recv_;
+    uint32_t sender_isn_ = 0;
+    uint32_t expected_ack_ = 0;
+    uint64_t expected_off_ = 0;    // 64-bit stream offset of expected_ack (file offset)
+
+    OpenOutput open_;
+    std::shared_ptr<OutputFd> file_;    // open_() once established
+    uint64_t file_off_;
+    std::unique_ptr<OutputFile> out_;   // sized from the agreed MSS, once established
+    SessionOutput* session_ = nullptr;  // file_ if it is a multi-file session
+    int64_t session_files_ = -1;        // file count the SYN announced
+
+    // MSS: answered in the SYN|ACK only if the SYN offered one (RDT_MSS otherwise)
+    bool offer_mss_ = false;
+    int mss_ = RDT_MSS;
+    int probe_echo_ = -1;               // size of a path MTU probe to echo in the next ACK
+
+    // fast open
+    uint64_t issue_cookie_ = 0;         // cookie for the SYN|ACK (0: none asked for, or the SYN's was valid)
+    std::vector<uint8_t> syn_data_;     // accepted SYN payload, written when the handshake completes
+
+    // FEC (only if the SYN offered it)
+    bool fec_on_ = false;
+    bool fec_hold_ = false;             // an ACK for data past a hole waits for the parity
+    uint32_t fec_last_ = 0;             // end of the latest block a parity covered
+    FecRing fec_ring_;
+    int fec_seg_ = 0;                   // largest DATA segment seen (the ring is sized for it)
+    std::deque<FecRebuilt> fec_pending_;   // rebuilt, the original may still come
+    std::deque<FecBlock> fec_wait_;     // parities of blocks with two holes (one may still arrive)
+    std::vector<uint8_t> fec_buf_;
+    uint64_t fec_parity_ = 0, fec_rebuilt_ = 0, fec_late_ = 0;   // rebuilt: known lost
+    uint64_t fec_dup_ = 0;              // DATA segments we already had (OPT_FEC_ACK)
+
+    // window scaling: our shift, used only if the SYN offered the option
+    int my_shift_ = -1;
+    uint16_t adv_wnd_;
+    uint32_t wnd_segs_ = UINT32_MAX;   // window in our last ACK (segments)
+    uint32_t min_wnd_ = UINT32_MAX;
+    uint64_t wnd_updates_ = 0;
+
+    RangeSet ooo_;                 // received byte ranges beyond expected_ack
+    uint32_t sack_recent_ = 0;     // seq of the latest out-of-order segment (first SACK block)
+    uint64_t start_ms_ = 0;
+
+    // ====== Delayed ACK state ======
+    int unacked_segs_ = 0;              // in-order segments received since our last ACK
+    uint64_t delack_at_ = UINT64_MAX;   // delayed-ACK deadline (us)
+    uint64_t acks_sent_ = 0, data_segs_ = 0;
+
+    // ====== RTO (sampled from SYN|ACK -> final ACK) ======
+    RtoEstimator rto_;
+    uint64_t synack_sent_ = 0;
+    int synack_retx_ = 0;
+
+    uint64_t fin_last_ = 0;
+    int fin_retx_ = 0;
+
+    TxBatch acks_;
+};
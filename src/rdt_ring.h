@@ -0,0 +1,84 @@
+#pragma once
+// Hand-off between the protocol thread and a disk thread.
+//
+// Buffers come from a fixed pool allocated up front; only their indices
+// travel through SpscRing, so the steady state allocates nothing and the
+// protocol thread never takes a lock or blocks. The disk thread sleeps on a
+// Waker when it has nothing to do.
+#include "rdt.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// ====== Bounded lock-free ring: exactly one producer and one consumer thread ======
+// head/tail count forever (no wrap flag); the slot is index & mask.
+template <class T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        buf_.resize(cap);
+        mask_ = cap - 1;
+    }
+
+    // producer only; false if full
+    bool push(const T& v) {
+        size_t t = tail_.load(std::memory_order_relaxed);
+        if (t - head_.load(std::memory_order_acquire) > mask_) return false;
+        buf_[t & mask_] = v;
+        tail_.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only; false if empty
+    bool pop(T& v) {
+        size_t h = head_.load(std::memory_order_relaxed);
+        if (h == tail_.load(std::memory_order_acquire)) return false;
+        v = buf_[h & mask_];
+        head_.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // exact for the consumer's lower bound / the producer's upper bound
+    size_t size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+
+private:
+    std::vector<T> buf_;
+    size_t mask_ = 0;
+    std::atomic<size_t> head_{0};
+    char pad_[64];   // keep the two indices off one cache line
+    std::atomic<size_t> tail_{0};
+};
+
+// ====== Disk thread sleep/wake ======
+// The lock is touched only while the disk thread is actually asleep: wake()
+// is one atomic load otherwise. The timed wait bounds a missed wake-up.
+class Waker {
+public:
+    template <class Ready>
+    void wait(Ready ready) {
+        if (ready()) return;
+        std::unique_lock<std::mutex> lk(mu_);
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!ready()) cv_.wait_for(lk, std::chrono::milliseconds(10));
+        sleeping_.store(false);
+    }
+
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!sleeping_.load()) return;
+        std::lock_guard<std::mutex> lk(mu_);
+        cv_.notify_one();
+    }
+
+private:
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::atomic<bool> sleeping_{false};
+};
@@ -0,0 +1,1059 @@
+#pragma once
+// Sending side of one connection: handshake, windowed transfer with SACK
+// loss recovery, congestion control and pacing, FIN exchange.
+//
+// sender.cpp runs one SendConnection, or one per stripe, each on its own
+// thread (--stripes). A connection owns its socket and event loop; the
+// InputSource it reads may be a RangeInput over a source shared with the
+// other stripes. With FEC (rdt_fec.h) every block of new DATA segments is
+// followed by an XOR parity segment the receiver can rebuild a loss from.
+#include "rdt.h"
+#include "rdt_input.h"
+#include "rdt_cc.h"
+#include "rdt_fec.h"
+#include "rdt_trace.h"
+#include <vector>
+#include <algorithm>
+
+struct OutSeg {
+    uint32_t seq;
+    uint16_t len;
+    const uint8_t* data = nullptr;   // view into the source buffer (never copied)
+    uint32_t psum = RDT_NO_PSUM;     // cached payload checksum sum
+    bool acked = false;
+    bool lost = false;               // inferred lost, retransmission pending
+    uint64_t last_sent_us = 0;
+    int retx = 0;
+};
+
+// What the segments newly acked by one ACK tell us: the bytes delivered and
+// an RTT sample candidate. Karn's rule: if any of them was retransmitted the
+// sample is ambiguous.
+struct AckSample {
+    uint64_t sent_us = 0;
+    bool ambiguous = false;
+    uint32_t bytes = 0;
+
+    void note(const OutSeg& seg) {
+        bytes += seg.len;
+        if (seg.retx > 0) ambiguous = true;
+        else sent_us = std::max(sent_us, seg.last_sent_us);
+    }
+    bool valid() const { return !ambiguous && sent_us != 0; }
+};
+
+// ====== Send window: fixed-capacity ring indexed by segment number ======
+// Segment k (k-th segment of the stream) lives in slot k % capacity. Slots are
+// released as soon as the cumulative ACK passes them, so memory is bounded by
+// the window, not the file size. inflight() and oldest_unacked() are O(1)
+// (amortized) instead of a walk over every segment ever sent.
+//
+// Loss recovery (RFC 6675) keeps two more cursors: lost_scan_ (segments
+// below it were checked against the SACK loss boundary) and next_lost_
+// (no lost segment below it). Both only move forward between RTOs, so
+// marking and finding lost segments is amortized O(1) per segment.
+class SendWindow {
+public:
+    explicit SendWindow(int capacity) : slots_((size_t)std::max(1, capacity)) {}
+
+    bool empty() const { return head_ == tail_; }
+    bool full() const { return tail_ - head_ == slots_.size(); }
+    int inflight() const { return inflight_; }   // sent and neither cum- nor SACK-acked
+    int lost() const { return lost_; }           // inferred lost, not retransmitted yet
+    // RFC 6675 pipe: segments believed to be in the network
+    int pipe() const { return inflight_ - lost_; }
+
+    // Append a freshly sent segment (caller checks full()).
+    OutSeg& push(uint32_t seq, uint16_t len) {
+        OutSeg& seg = slot(tail_++);
+        seg.seq = seq;
+        seg.len = len;
+        seg.acked = false;
+        seg.lost = false;
+        seg.last_sent_us = 0;
+        seg.retx = 0;
+        seg.data = nullptr;
+        seg.psum = RDT_NO_PSUM;
+        inflight_++;
+        return seg;
+    }
+
+    void mark_acked(OutSeg& seg, AckSample& sample) {
+        if (seg.acked) return;
+        seg.acked = true;
+        inflight_--;
+        if (seg.lost) {
+            seg.lost = false;
+            lost_--;
+        }
+        sample.note(seg);
+    }
+
+    // SACK loss boundary: every unacked segment ending at or before f is lost.
+    void mark_lost_below(uint32_t f) {
+        if (lost_scan_ < head_) lost_scan_ = head_;
+        for (; lost_scan_ != tail_; lost_scan_++) {
+            OutSeg& seg = slot(lost_scan_);
+            if (seq_gt(seg.seq + seg.len, f)) break;
+            mark_lost(lost_scan_);
+        }
+    }
+
+    // Oldest unacked segment is lost (3 dupACKs, NewReno partial ACK).
+    void mark_oldest_lost() {
+        if (oldest_unacked()) mark_lost(una_);
+    }
+
+    // RTO: everything not SACKed is lost.
+    void mark_all_lost() {
+        for (uint64_t k = head_; k != tail_; k++) mark_lost(k);
+        lost_scan_ = tail_;
+    }
+
+    // Lowest segment waiting for retransmission (nullptr if none).
+    OutSeg* next_lost() {
+        if (lost_ == 0) return nullptr;
+        if (next_lost_ < head_) next_lost_ = head_;
+        while (next_lost_ != tail_ && !slot(next_lost_).lost) next_lost_++;
+        return next_lost_ == tail_ ? nullptr : &slot(next_lost_);
+    }
+
+    // seg (from next_lost()) is being retransmitted: back in the pipe.
+    void retransmitting(OutSeg& seg) {
+        if (!seg.lost) return;
+        seg.lost = false;
+        lost_--;
+    }
+
+    // Cumulative ACK: every segment with seq+len <= ackno is acked and released.
+    void ack_upto(uint32_t ackno, AckSample& sample) {
+        while (head_ != tail_) {
+            OutSeg& seg = slot(head_);
+            if (seq_lt(ackno, seg.seq + seg.len)) break;
+            mark_acked(seg, sample);
+            head_++;
+        }
+        if (una_ < head_) una_ = head_;
+    }
+
+    // Oldest sent segment that is not acked yet (nullptr if none).
+    OutSeg* oldest_unacked() {
+        if (una_ < head_) una_ = head_;
+        while (una_ != tail_ && slot(una_).acked) una_++;
+        return una_ == tail_ ? nullptr : &slot(una_);
+    }
+
+    // Segment starting exactly at seq (nullptr if not in the window).
+    OutSeg* find(uint32_t seq) {
+        uint64_t k = lower(seq);
+        if (k == tail_ || slot(k).seq != seq) return nullptr;
+        return &slot(k);
+    }
+
+    // Visit every segment overlapping [start, end), in sequence order.
+    template <class F>
+    void for_range(uint32_t start, uint32_t end, F f) {
+        if (head_ == tail_) return;
+        uint64_t k = lower(start);
+        if (k > head_ && seq_gt(slot(k - 1).seq + slot(k - 1).len, start)) k--;
+        for (; k != tail_ && seq_lt(slot(k).seq, end); k++) f(slot(k));
+    }
+
+private:
+    OutSeg& slot(uint64_t k) { return slots_[k % slots_.size()]; }
+
+    // First segment number whose seq is not below seq (binary search: seqs
+    // ascend along the ring).
+    uint64_t lower(uint32_t seq) {
+        if (head_ == tail_) return tail_;
+        uint32_t base = slot(head_).seq;
+        uint32_t rel = seq - base;
+        uint64_t lo = head_, hi = tail_;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (slot(mid).seq - base < rel) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    void mark_lost(uint64_t k) {
+        OutSeg& seg = slot(k);
+        if (seg.acked || seg.lost) return;
+        seg.lost = true;
+        lost_++;
+        if (k < next_lost_) next_lost_ = k;
+    }
+
+    std::vector<OutSeg> slots_;
+    uint64_t head_ = 0;   // oldest segment not yet released by the cumulative ACK
+    uint64_t tail_ = 0;   // next segment number to be sent
+    uint64_t una_  = 0;   // oldest-unacked cursor (head_ <= una_ <= tail_)
+    uint64_t lost_scan_ = 0;
+    uint64_t next_lost_ = 0;
+    int inflight_  = 0;
+    int lost_      = 0;
+};
+
+// ====== SACK scoreboard ======
+// Every byte range the receiver has SACKed beyond the cumulative ACK. ACKs
+// repeat blocks the scoreboard already holds, so only the newly covered parts
+// are walked in the window: work per ACK follows what it adds, not the window
+// size, and segments of any length are handled.
+static inline void apply_sack(uint32_t cum_ack, const RdtOptions& opt, RangeSet& board,
+                       SendWindow& win, AckSample& sample) {
+    board.advance(cum_ack);
+    std::vector<SackBlock> fresh;
+    for (int i = 0; i < opt.nsack; i++) {
+        SackBlock b = opt.sack[i];
+        if (seq_leq(b.end, cum_ack)) continue;   // stale (D-SACK-like) block
+        if (seq_lt(b.start, cum_ack)) b.start = cum_ack;
+        fresh.clear();
+        SackBlock m = board.add(b.start, b.end, &fresh);
+        for (const SackBlock& f : fresh) {
+            win.for_range(f.start, f.end, [&](OutSeg& seg) {
+                if (seq_geq(seg.seq, m.start) && seq_leq(seg.seq + seg.len, m.end)) win.mark_acked(seg, sample);
+            });
+        }
+    }
+}
+
+// RFC 6675 IsLost(): an unSACKed segment is lost once more than
+// (DupThresh - 1) * MSS bytes above it have been SACKed (mss: the segment
+// size in use). Walks the scoreboard from the top (usually one or two ranges)
+// for the boundary f: unSACKed segments ending at or before f are lost.
+// False if no segment qualifies yet.
+static inline bool lost_boundary(const RangeSet& board, int mss, uint32_t& f) {
+    const uint32_t need = (RDT_DUPTHRESH - 1) * (uint32_t)mss + 1;
+    uint32_t acc = 0;
+    for (size_t i = board.size(); i-- > 0;) {
+        uint32_t len = board[i].end - board[i].start;
+        if (acc + len >= need) {
+            f = board[i].end - (need - acc);
+            return true;
+        }
+        acc += len;
+    }
+    return false;
+}
+
+// ====== Path MTU probing (DPLPMTUD, RFC 8899) ======
+// DATA starts at the base size, which every path is assumed to carry. A probe
+// is a padding-only datagram of a candidate size (F_PROBE, no sequence space);
+// the receiver echoes its size in OPT_PMTU and the echo confirms that size for
+// DATA. The search climbs the common link MTUs up to the agreed MSS; once a
+// size fails MAX_PROBES times it bisects between the largest confirmed size
+// and the failed one. One probe is outstanding at a time, and a lost probe
+// only costs its timeout: it says nothing about congestion.
+class MtuProber {
+public:
+    static constexpr int MAX_PROBES = 3;    // tries per size (RFC 8899 MAX_PROBES)
+    static constexpr int RESOLUTION = 64;   // bisection stops at this gap (bytes)
+
+    // base: confirmed to start with; max: the agreed MSS (no search if base >= max)
+    MtuProber(int base, int max) : mss_(std::min(base, max)), max_(max), fail_(max + 1) {}
+
+    int mss() const { return mss_; }   // largest confirmed payload
+
+    // Size of a probe to send now, 0 if one is outstanding or the search is
+    // over. An outstanding probe past its deadline counts as lost first.
+    int next(uint64_t now) {
+        if (probe_ != 0) {
+            if (now < deadline_) return 0;
+            lost_++;
+            if (++tries_ >= MAX_PROBES) failed(probe_);
+            probe_ = 0;
+        }
+        return candidate();
+    }
+
+    void sent(int size, uint64_t deadline) {
+        probe_ = size;
+        deadline_ = deadline;
+        sent_++;
+    }
+
+    // The local stack refused the datagram (EMSGSIZE): no need to retry it.
+    void refused(int size) { failed(size); }
+
+    // An echo of size arrived; true if the confirmed size grew.
+    bool on_echo(int size) {
+        if (size == probe_) {
+            probe_ = 0;
+            tries_ = 0;
+        }
+        if (size <= mss_ || size > max_) return false;
+        mss_ = size;
+        if (fail_ <= mss_) fail_ = max_ + 1;
+        return true;
+    }
+
+    uint64_t deadline() const { return probe_ != 0 ? deadline_ : UINT64_MAX; }
+    uint64_t probes() const { return sent_; }
+    uint64_t lost() const { return lost_; }
+
+private:
+    int candidate() const {
+        if (mss_ >= max_) return 0;
+        if (fail_ > max_) {
+            // Ethernet (1500) and jumbo (9000) MTUs less the IPv4, UDP and RDT headers
+            static const int steps[] = {1452, 8952};
+            for (int s : steps) {
+                if (s > mss_ && s < max_) return s;
+            }
+            return max_;
+        }
+        return fail_ - mss_ > RESOLUTION ? mss_ + (fail_ - mss_) / 2 : 0;
+    }
+
+    void failed(int size) {
+        if (size > mss_) fail_ = std::min(fail_, size);
+        tries_ = 0;
+    }
+
+    int mss_;
+    int max_;
+    int fail_;                  // smallest size known not to pass (max_ + 1: none yet)
+    int probe_ = 0;             // outstanding probe size (0: none)
+    int tries_ = 0;             // lost probes of the current size
+    uint64_t deadline_ = 0;
+    uint64_t sent_ = 0, lost_ = 0;
+};
+
+static inline sockaddr_in make_addr(const std::string& ip, int port) {
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_port = htons((uint16_t)port);
+    a.sin_addr.s_addr = inet_addr(ip.c_str());
+    return a;
+}
+
+struct SenderConfig {
+    std::string client_ip;
+    int client_port = 0;
+    std::string router_ip;
+    int router_port = 0;
+    int fixed_wnd = 1;         // segments of the agreed MSS
+    int mss = 0;               // largest segment payload offered in the SYN (0: automatic, see max_mss())
+    bool pmtud = true;         // probe the path from RDT_MSS up to the agreed MSS
+    CcAlgo cc_algo = CC_RENO;
+    double pace_gain = 1.0;
+    double pace_max = 0.0;     // MB/s, 0 = no cap
+    std::string trace_path;    // binary trace written after the transfer ("" = none)
+    int trace_level = 1;       // see rdt_trace.h
+    bool verbose = false;      // also LOG every retransmission / ACK advance / recovery
+    StripeInfo stripe;         // sent in the SYN when stripe.cnt > 0
+    int64_t session = -1;      // file count of a multi-file session (SessionInput), sent in the SYN
+    bool fastopen = false;     // data in the SYN with the receiver's cookie (or ask for one)
+    uint64_t cookie = 0;       // the receiver's cookie from an earlier connection (0: none)
+    int fec = 0;               // parity per K DATA segments: 0 off, -1 auto (K from the loss rate), else K
+
+    // Automatic MSS: as large as a datagram allows when probing finds what the
+    // path carries, the base size otherwise.
+    int max_mss() const { return mss > 0 ? mss : pmtud ? RDT_MAX_MSS : RDT_MSS; }
+};
+
+struct SenderStats {
+    uint64_t bytes = 0;
+    double sec = 0.0;
+    int64_t srtt_us = 0;
+    uint64_t fast_retx = 0, rto_count = 0, retx_segs = 0;
+    uint64_t tx_pkts = 0;
+    int mss = 0;               // segment size in use at the end
+    uint64_t cookie = 0;       // fast-open cookie the receiver issued (0: none, or ours was valid)
+    uint32_t syn_data = 0;     // bytes the receiver took from the SYN
+    double total_sec = 0.0;    // from the first SYN (sec starts once connected)
+    uint64_t fec_parity = 0;   // parity segments sent
+    uint64_t fec_rebuilt = 0;  // lost segments the receiver rebuilt from them
+    int fec_k = 0;             // DATA segments per parity at the end (0: FEC off)
+
+    double mbps() const { return bytes / 1024.0 / 1024.0 / std::max(1e-9, sec); }
+};
+
+class SendConnection {
+public:
+    // tag prefixes every log line (empty for a single connection)
+    SendConnection(const SenderConfig& cfg, InputSource& src, const std::string& tag = std::string())
+        : cfg_(cfg), src_(src), tag_(tag) {}
+
+    // Handshake, transfer every byte of src, FIN exchange. Dies on a
+    // connection failure (too many retransmissions).
+    void run();
+
+    const SenderStats& stats() const { return stats_; }
+
+private:
+    void log(const char* fmt, ...) {
+        va_list ap;
+        va_start(ap, fmt);
+        vlog(tag_.c_str(), fmt, ap);
+        va_end(ap);
+    }
+
+    SenderConfig cfg_;
+    InputSource& src_;
+    std::string tag_;
+    SenderStats stats_;
+};
+
+inline void SendConnection::run() {
+    const std::string& client_ip = cfg_.client_ip;
+    int client_port = cfg_.client_port;
+    const std::string& router_ip = cfg_.router_ip;
+    int router_port = cfg_.router_port;
+    int local_mss = cfg_.max_mss();
+    int fixed_wnd = std::min<int>(cfg_.fixed_wnd, (int)max_wnd_for(local_mss));
+    InputSource* src = &src_;
+
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == INVALID_SOCKET) die("socket");
+    set_nonblocking(sock);
+    int sockbuf = set_socket_buffers(sock, (uint64_t)fixed_wnd * local_mss);
+    // probes must be dropped, not fragmented, when they exceed the path MTU
+    bool df = cfg_.pmtud && set_dont_fragment(sock);
+
+    // IMPORTANT: bind client ip/port (recommended for router env)
+    sockaddr_in local = make_addr(client_ip, client_port);
+    if (bind(sock, (sockaddr*)&local, sizeof(local)) != 0) die("bind(client)");
+    log("Sender bind at %s:%d (sockbuf=%d KB)", client_ip.c_str(), client_port, sockbuf / 1024);
+
+    // peer is ROUTER
+    sockaddr_in peer = make_addr(router_ip, router_port);
+    log("Peer(router) = %s:%d", router_ip.c_str(), router_port);
+
+    // ====== 3-way handshake ======
+    uint32_t isn_send = rdt_isn();
+    // connection ID: tells the receiver this upload from others sharing our address
+    uint16_t conn_id = (uint16_t)(rdt_isn() >> 16);
+    uint32_t peer_isn = 0;
+
+    // window scaling (negotiated: used only if both SYN and SYN|ACK carry it)
+    int my_shift = 0;                  // applied to the wnd we advertise
+    int peer_shift = 0;                // applied to the wnd the receiver advertises
+    uint32_t peer_wnd = (uint32_t)fixed_wnd;
+    uint16_t adv_wnd = wnd_field((uint32_t)fixed_wnd, 0);
+
+    // MSS (negotiated: the smaller offer; RDT_MSS if the receiver sends none).
+    // The agreed MSS is also the unit of the receiver's window.
+    int agreed_mss = std::min(local_mss, RDT_MSS);
+    uint32_t wnd_cap = RDT_MAX_WND;
+
+    uint32_t base_ack  = isn_send + 1; // data starts from isn+1
+    uint32_t next_seq  = base_ack;
+
+    bool established = false;
+    uint64_t syn_last = 0;
+    int syn_retx = 0;
+    uint64_t syn_first_ms = now_ms();
+
+    // ====== Fast open: the first segment rides in the SYN ======
+    // Only the first SYN carries it (a SYN retransmitted after a loss is
+    // bare, as in RFC 7413). The SYN|ACK tells whether the receiver took it:
+    // its ACK covers the data, or only the SYN (no or an invalid cookie, or
+    // a receiver without fast open), and then the data goes out as usual.
+    const uint8_t* syn_data = nullptr;
+    size_t syn_len = 0;
+    uint32_t syn_acked = 0;
+    bool fec_agreed = false;
+    if (cfg_.fastopen && cfg_.cookie != 0) {
+        // a stream's reader thread has only just started: give it a moment
+        for (int i = 0; i < 100 && !syn_data && !src->at_end(0); i++) {
+            syn_data = src->peek(0, (size_t)agreed_mss, syn_len);
+            if (!syn_data) std::this_thread::sleep_for(std::chrono::microseconds(RDT_DISK_POLL_US));
+        }
+        log("Fast open: %zu bytes in the SYN (cookie %016llx)", syn_len, (unsigned long long)cfg_.cookie);
+    } else if (cfg_.fastopen) {
+        log("Fast open: no cookie for this receiver yet, asking for one");
+    }
+
+    // one estimator drives SYN, DATA and FIN retransmission
+    RtoEstimator rto;
+
+    RxBatch rx;
+    TxBatch tx;
+    IoStats io;
+
+    log("Connecting (SYN, conn=%04x) ...", conn_id);
+    while (!established) {
+        uint64_t t = now_us();
+        if (syn_retx == 0 || t - syn_last >= rto.rto()) {
+            if (syn_retx > 0) rto.on_timeout();
+            if (syn_retx++ > RDT_MAX_RETX) die("handshake failed (too many retries)");
+            RdtHeader syn{};
+            syn.seq = isn_send;
+            syn.ack = 0;
+            syn.flags = F_SYN;
+            syn.wnd = adv_wnd;   // never scaled in SYN
+            syn.len = syn_retx == 1 ? (uint16_t)syn_len : 0;
+            syn.conn = conn_id;
+            RdtOptions so;
+            so.mss = local_mss;
+            so.wscale = wscale_for((uint32_t)fixed_wnd);
+            so.stripe = cfg_.stripe;
+            so.session = cfg_.session;
+            so.fec = cfg_.fec != 0;
+            if (cfg_.fastopen) {
+                so.tfo = cfg_.cookie != 0 ? 1 : 0;
+                so.cookie = cfg_.cookie;
+            }
+            send_pkt(sock, peer, syn, syn.len > 0 ? syn_data : nullptr, RDT_NO_PSUM, &so);
+            syn_last = t;
+            log("TX SYN(seq=%u, len=%u) retx=%d", isn_send, syn.len, syn_retx - 1);
+        }
+
+        wait_readable(sock, ms_until(syn_last + rto.rto(), now_us()));
+
+        int nrx = recv_batch(sock, rx, io);
+        for (int i = 0; i < nrx && !established; i++) {
+            RdtHeader h{};
+            RdtOptions opt;
+            uint8_t* payload = nullptr;
+            if (!parse_pkt(rx.slot(i), rx.len[i], h, opt, payload)) continue;
+            if (h.conn != conn_id) continue;   // another connection's packet
+
+            bool took_data = syn_len > 0 && h.ack == isn_send + 1 + (uint32_t)syn_len;
+            if ((h.flags & (F_SYN | F_ACK)) == (F_SYN | F_ACK) && (h.ack == isn_send + 1 || took_data)) {
+                peer_isn = h.seq;
+                if (took_data) {
+                    syn_acked = (uint32_t)syn_len;
+                    base_ack = next_seq = h.ack;
+                }
+                if (opt.tfo == 1 && opt.cookie != cfg_.cookie) {
+                    stats_.cookie = opt.cookie;
+                    log("Fast open: cookie %016llx issued", (unsigned long long)opt.cookie);
+                }
+                if (syn_len > 0 && !took_data) log("Fast open: SYN data not taken, sending it after the handshake");
+                if (syn_retx == 1) rto.on_sample(int64_t(now_us() - syn_last));
+                fec_agreed = opt.fec;
+
+                if (opt.wscale >= 0) {
+                    peer_shift = opt.wscale;
+                    my_shift = wscale_for((uint32_t)fixed_wnd);
+                    adv_wnd = wnd_field((uint32_t)fixed_wnd, my_shift);
+                }
+                if (opt.mss >= 0) {
+                    agreed_mss = std::max(1, std::min(local_mss, opt.mss));
+                    wnd_cap = max_wnd_for(agreed_mss);
+                }
+                peer_wnd = std::min<uint32_t>(h.wnd, wnd_cap);   // SYN|ACK wnd is unscaled
+
+                RdtHeader ack{};
+                ack.seq = next_seq;
+                ack.ack = peer_isn + 1;
+                ack.flags = F_ACK;
+                ack.wnd = adv_wnd;
+                ack.len = 0;
+                ack.conn = conn_id;
+                send_pkt(sock, peer, ack, nullptr);
+
+                established = true;
+                log("RX SYN|ACK(seq=%u, ack=%u) -> TX ACK(ack=%u). Connected. peerWnd=%u wscale=%d/%d mss=%d",
+                    peer_isn, h.ack, ack.ack, peer_wnd, my_shift, peer_shift, agreed_mss);
+            }
+        }
+    }
+
+    // ====== Segment size: path MTU probing from the base size up to the agreed MSS ======
+    MtuProber pmtu(cfg_.pmtud ? RDT_MSS : agreed_mss, agreed_mss);
+    int mss = pmtu.mss();
+    std::vector<uint8_t> probe_pad;   // probe payload
+    if (pmtu.next(now_us()) > 0) {
+        probe_pad.assign((size_t)agreed_mss, 0);
+        log("Path MTU probing: %d -> %d bytes%s", mss, agreed_mss, df ? "" : " (DF unavailable)");
+    }
+
+    // ====== Congestion control (cwnd/ssthresh live in the controller) ======
+    std::unique_ptr<CongestionController> cc = make_cc(cfg_.cc_algo, (uint64_t)fixed_wnd * agreed_mss, mss);
+    if (syn_acked > 0) {
+        // the SYN|ACK acknowledged the SYN's segment: it grows cwnd as any ACK would
+        AckEvent ev;
+        ev.acked = ev.delivered = syn_acked;
+        ev.now_us = now_us();
+        cc->on_ack(ev);
+    }
+    int dup_ack_cnt = 0;
+    uint32_t last_ack = base_ack;
+    uint32_t last_wnd = peer_wnd;     // window advertised with last_ack (dupACK test)
+
+    // ====== Loss recovery (RFC 6675 + NewReno partial ACKs, RFC 6582) ======
+    bool in_recovery = false;     // fast recovery: from loss detection to the full ACK
+    uint32_t recover_seq = base_ack;   // next_seq when the last recovery/RTO started
+    uint64_t recovery_start_us = 0;
+    uint64_t fast_retx = 0, rto_count = 0, retx_segs = 0;
+    uint64_t acked_off = syn_acked;   // 64-bit stream offset of last_ack (seq numbers wrap, this does not)
+    log("Congestion control: %s", cc->name());
+
+    // ====== Pacing (token bucket at gain x controller rate) ======
+    Pacer pacer(cfg_.pace_gain, cfg_.pace_max * 1024 * 1024);
+    pacer.set_mss(mss);
+    if (cfg_.pace_gain > 0.0 || cfg_.pace_max > 0.0) log("Pacing: gain=%.2f max=%.1f MB/s", cfg_.pace_gain, cfg_.pace_max);
+    else log("Pacing: off");
+
+    // ====== FEC: an XOR parity segment after every block of new DATA ======
+    FecEncoder fec(cfg_.fec);
+    if (cfg_.fec != 0) {
+        if (fec_agreed && agreed_mss > 4 * FEC_OPT_ROOM) {
+            fec.enable();
+            if (cfg_.fec < 0) log("FEC: auto, parity every %d segments to start", fec.k());
+            else log("FEC: parity every %d segments", fec.k());
+        } else {
+            log("FEC: %s, no parity", agreed_mss <= 4 * FEC_OPT_ROOM ? "segments too small" : "declined by the receiver (--fec=0 or no FEC)");
+        }
+    }
+    uint64_t fec_rebuilt = 0;
+    uint64_t fec_dup = 0;     // segments the receiver got twice: retransmissions that were not needed
+    uint64_t rto_sweep = 0;   // segments marked lost by timeouts beyond the one that timed out
+    // the parity goes out in the batch with the block's last segment
+    auto send_parity = [&]() {
+        RdtHeader ph{};
+        RdtOptions po;
+        const uint8_t* parity = fec.take(tx.n, ph, po);
+        ph.ack = 0;
+        ph.flags = F_FEC;
+        ph.wnd = adv_wnd;
+        ph.conn = conn_id;
+        tx.add(ph, parity, RDT_NO_PSUM, &po);
+        pacer.on_send(ph.len);
+        if (tx.full()) flush_batch(sock, peer, tx, io);
+    };
+
+    // ====== SACK scoreboard (byte ranges SACKed beyond last_ack) ======
+    RangeSet sack_board;
+
+    // ====== Tracing (binary ring + counters; per-event LOG only with --verbose) ======
+    Tracer tr(cfg_.trace_level);
+    bool verbose = cfg_.verbose;
+    int logged_cwnd = cc->cwnd();
+    tr.ev(TR_CWND, (uint32_t)logged_cwnd, (uint32_t)cc->ssthresh());   // initial cwnd
+    auto note_cwnd = [&]() {       // Record cwnd changes made by the controller
+        if (cc->cwnd() != logged_cwnd) {
+            logged_cwnd = cc->cwnd();
+            tr.ev(TR_CWND, (uint32_t)logged_cwnd, (uint32_t)cc->ssthresh(), in_recovery ? 1 : 0);
+        }
+    };
+
+    // ====== send buffer (sliding window) ======
+    SendWindow win(fixed_wnd);
+    uint64_t file_off = syn_acked;   // the SYN's data (fast open) is already acknowledged
+    src->release(acked_off);
+
+    // ====== Zero-window probe (persist timer) ======
+    // The receiver's window follows its disk writer; if it closes with
+    // nothing in flight, no ACK will reopen it unless we ask.
+    uint64_t probe_at = 0;        // 0: not armed
+    uint64_t probes = 0;
+
+    // ====== FIN state ======
+    bool fin_sent = false;
+    bool fin_acked = false;
+    uint64_t fin_last = 0;
+    int fin_retx = 0;
+
+    uint64_t start_ms = now_ms();
+
+    bool done = false;
+    while (!done) {
+        // effective window = min(fixed flow-control wnd, cwnd)
+        // inflight：当前在途未确认分片数（环形窗口维护，O(1)）
+        int eff_wnd = std::min(cc->cwnd(), fixed_wnd);
+        // OPT_FEC rides only in parity segments, which are as long as the DATA they cover
+        const int fec_room = fec.on() ? FEC_OPT_ROOM : 0;
+        // losses for the FEC loss rate: a timeout counts once, not its whole flight
+        // (nor do the duplicates its retransmissions may cause)
+        if (fec.on()) {
+            fec.observe(retx_segs - std::min(retx_segs, rto_sweep) + fec_rebuilt,
+                        fec_dup - std::min(fec_dup, rto_sweep), now_us(), rto.rto());
+        }
+        pacer.set_rate(cc->pacing_rate(rto.srtt_us), now_us());
+        bool paced = false;   // stopped by the pacer, not by the window
+        bool starved = false; // the reader thread has not delivered the next bytes yet
+        bool wnd_closed = false;
+
+        // ====== Fill window: lost segments first, then new DATA ======
+        // pipe (RFC 6675) counts what is still in the network: segments not
+        // acked, not SACKed and not known lost
+        while (win.pipe() < eff_wnd) {
+            if (OutSeg* lost = win.next_lost()) {
+                auto& seg = *lost;
+                if (!pacer.ready(now_us())) { paced = true; break; }
+                win.retransmitting(seg);
+                if (++seg.retx > RDT_MAX_RETX) die("too many retransmissions");
+                retx_segs++;
+
+                RdtHeader dh{};
+                dh.seq = seg.seq;
+                dh.ack = 0;
+                dh.flags = F_DATA;
+                dh.wnd = adv_wnd;
+                dh.len = seg.len;
+                dh.conn = conn_id;
+
+                tx.add(dh, seg.data, seg.psum);
+                seg.last_sent_us = now_us();
+                pacer.on_send(seg.len);
+                tr.ev(TR_RETX, seg.seq, seg.len, (uint16_t)seg.retx);
+                if (verbose) log("Retransmit seq=%u (lost) retx=%d pipe=%d cwnd=%d", seg.seq, seg.retx, win.pipe(), cc->cwnd());
+
+                if (tx.full()) flush_batch(sock, peer, tx, io);
+                continue;
+            }
+
+            // the ring also caps the span [cum ack, next_seq) at our window, the
+            // last check at the window the receiver advertises
+            if (win.full()) break;
+            uint32_t wnd_bytes = peer_wnd * (uint32_t)agreed_mss;
+            if (!seq_lt(next_seq, last_ack + wnd_bytes)) { wnd_closed = true; break; }
+            // silly-window avoidance: no runt segment while half the window is still out
+            uint32_t room = last_ack + wnd_bytes - next_seq;
+            if (room < (uint32_t)mss && room < wnd_bytes / 2) break;
+            // right after the MSS grew the window may be less than one segment
+            uint32_t seg_max = (uint32_t)(mss - fec_room);
+            if (cc->cwnd_bytes() < seg_max) seg_max = std::max<uint32_t>(1, (uint32_t)cc->cwnd_bytes());
+            size_t avail = 0;
+            const uint8_t* p = src->peek(file_off, std::min<uint32_t>(room, seg_max), avail);
+            if (!p) {
+                // EOF, stream read-ahead waiting for ACKs, or the reader is behind
+                starved = !src->at_end(file_off) && win.empty();
+                break;
+            }
+            if (!pacer.ready(now_us())) { paced = true; break; }
+            uint16_t chunk = (uint16_t)avail;
+
+            OutSeg& seg = win.push(next_seq, chunk);
+            seg.data = p;
+            seg.psum = checksum_add(0, p, chunk);
+
+            RdtHeader dh{};
+            dh.seq = seg.seq;
+            dh.ack = 0;
+            dh.flags = F_DATA;
+            dh.wnd = adv_wnd;
+            dh.len = seg.len;
+            dh.conn = conn_id;
+
+            tx.add(dh, seg.data, seg.psum);
+            seg.last_sent_us = now_us();
+            pacer.on_send(chunk);
+            tr.ev(TR_TX, seg.seq, chunk);
+
+            file_off += chunk;
+            next_seq += chunk;
+
+            if (tx.full()) flush_batch(sock, peer, tx, io);
+            if (fec.on()) {
+                fec.add(seg.seq, p, chunk, eff_wnd);
+                if (fec.full()) send_parity();
+            }
+        }
+        // a partial block is closed when no DATA follows it soon (the
+        // receiver holds its ACK for a hole until the parity arrives)
+        if (fec.pending() && (src->at_end(file_off) || starved || wnd_closed)) send_parity();
+        // the whole window goes to the kernel in one call
+        if (tx.n > 0) flush_batch(sock, peer, tx, io);
+
+        // ====== Path MTU probe (outside cwnd, one at a time) ======
+        for (int len; !fin_sent && (len = pmtu.next(now_us())) > 0;) {
+            RdtHeader ph{};
+            ph.seq = next_seq;
+            ph.ack = 0;
+            ph.flags = F_PROBE;
+            ph.wnd = adv_wnd;
+            ph.len = (uint16_t)len;
+            ph.conn = conn_id;
+            if (send_pkt(sock, peer, ph, probe_pad.data()) >= 0 || would_block()) {
+                pmtu.sent(len, now_us() + rto.rto());
+                if (verbose) log("Path MTU probe: %d bytes", len);
+                break;
+            }
+            pmtu.refused(len);   // EMSGSIZE: larger than the local interface MTU
+        }
+
+        // ====== Check if all data acked -> FIN ======
+        bool all_acked = src->at_end(file_off) && win.empty();
+
+        if (all_acked && !fin_sent) {
+            RdtHeader fin{};
+            fin.seq = next_seq; // FIN consumes 1 seq number
+            fin.ack = 0;
+            fin.flags = F_FIN;
+            fin.wnd = adv_wnd;
+            fin.len = 0;
+            fin.conn = conn_id;
+            send_pkt(sock, peer, fin, nullptr);
+
+            fin_sent = true;
+            fin_last = now_us();
+            log("TX FIN(seq=%u)", fin.seq);
+        }
+
+        // ====== Wait for ACKs or the next RTO / FIN / pacing deadline ======
+        uint64_t deadline = UINT64_MAX;
+        if (OutSeg* o = win.oldest_unacked()) deadline = o->last_sent_us + rto.rto();
+        if (fin_sent && !fin_acked) deadline = std::min(deadline, fin_last + rto.rto());
+        if (paced) deadline = std::min(deadline, pacer.next_send_us(now_us()));
+        if (!fin_sent) deadline = std::min(deadline, pmtu.deadline());
+        if (starved) deadline = std::min(deadline, now_us() + RDT_DISK_POLL_US);
+        if (wnd_closed && win.empty() && !fin_sent) {
+            if (probe_at == 0) probe_at = now_us() + rto.rto();
+            deadline = std::min(deadline, probe_at);
+        } else {
+            probe_at = 0;
+        }
+        wait_readable(sock, ms_until(deadline, now_us()));
+
+        // ====== Receive ACKs / FINs (drain everything pending, a batch per syscall) ======
+        int nrx;
+        do {
+            nrx = recv_batch(sock, rx, io);
+            for (int i = 0; i < nrx && !done; i++) {
+                RdtHeader h{};
+                RdtOptions opt;
+                uint8_t* payload = nullptr;
+                if (!parse_pkt(rx.slot(i), rx.len[i], h, opt, payload)) continue;
+                if (h.conn != conn_id) continue;
+                tr.ev(TR_RX, h.ack, h.wnd, h.flags);
+
+                // Peer FIN: ACK it and finish
+                if (h.flags & F_FIN) {
+                    RdtHeader ack{};
+                    ack.seq = next_seq + 1;
+                    ack.ack = h.seq + 1;
+                    ack.flags = F_ACK;
+                    ack.wnd = adv_wnd;
+                    ack.len = 0;
+                    ack.conn = conn_id;
+                    send_pkt(sock, peer, ack, nullptr);
+                    log("RX FIN(seq=%u) -> TX ACK(ack=%u). Done.", h.seq, ack.ack);
+                    done = true;
+                    break;
+                }
+
+                if (h.flags & F_ACK) {
+                    uint32_t ackno = h.ack;
+                    peer_wnd = std::min<uint32_t>((uint32_t)h.wnd << peer_shift, wnd_cap);
+                    bool wnd_same = peer_wnd == last_wnd;
+                    last_wnd = peer_wnd;
+                    if (opt.fec_rebuilt > (int64_t)fec_rebuilt) fec_rebuilt = (uint64_t)opt.fec_rebuilt;
+                    if (opt.fec_dup > fec_dup) fec_dup = opt.fec_dup;
+
+                    // probe echo: DATA may use the larger size from now on
+                    if (opt.pmtu > 0 && pmtu.on_echo(opt.pmtu)) {
+                        mss = pmtu.mss();
+                        cc->set_mss(mss);
+                        pacer.set_mss(mss);
+                        note_cwnd();
+                        log("Path MTU: %d-byte segments confirmed, cwnd=%d", mss, cc->cwnd());
+                    }
+
+                    uint64_t t = now_us();
+                    AckSample sample;
+                    uint32_t newly = 0;
+                    bool partial = false;
+
+                    // 1) new cumulative ACK
+                    if (seq_gt(ackno, last_ack)) {
+                        dup_ack_cnt = 0;
+                        newly = ackno - last_ack;
+
+                        // 累计ACK：所有 (seq+len)<=ackno 的段 acked=true
+                        win.ack_upto(ackno, sample);
+                        acked_off += newly;
+                        src->release(acked_off);
+                        last_ack = ackno;
+
+                        // full ACK ends recovery; a partial ACK (below recover_seq) does not
+                        if (in_recovery) {
+                            if (seq_geq(ackno, recover_seq)) {
+                                in_recovery = false;
+                                cc->on_recovery_exit();
+                                if (verbose) log("Full ACK %u -> recovery done", ackno);
+                            } else {
+                                partial = true;
+                            }
+                        }
+                    }
+                    // 2) dupACK (RFC 5681 §2: data outstanding, same window; a window
+                    //    update or probe echo repeats the ACK without signalling loss)
+                    else if (ackno == last_ack && opt.pmtu < 0 && !win.empty() && wnd_same) {
+                        dup_ack_cnt++;
+                    }
+
+                    if (ackno == last_ack) {
+                        // SACK 标记：ackno 之后已到达的段记入 scoreboard 并标记 acked
+                        // (a dupACK's SACK blocks count as much as a new ACK's)
+                        apply_sack(ackno, opt, sack_board, win, sample);
+                        tr.ev(TR_ACK, ackno, newly, (uint16_t)std::min(dup_ack_cnt, 0xFFFF));
+                        if (opt.nsack > 0) tr.ev(TR_SACK, opt.sack[0].start, opt.sack[0].end, (uint16_t)opt.nsack);
+
+                        // RTT sample (Karn: skipped if a retransmitted segment was acked)
+                        if (sample.valid()) {
+                            rto.on_sample(int64_t(t - sample.sent_us));
+                            cc->on_rtt_sample(int64_t(t - sample.sent_us), t);
+                            tr.rtt(int64_t(t - sample.sent_us), rto.srtt_us);
+                        }
+
+                        // ====== Loss detection (RFC 6675 IsLost + NewReno partial ACK) ======
+                        uint32_t f;
+                        if (lost_boundary(sack_board, mss, f)) win.mark_lost_below(f);
+                        if (partial) {
+                            // the hole right above a partial ACK is lost too, unless it
+                            // was already retransmitted in this episode
+                            OutSeg* o = win.oldest_unacked();
+                            if (o && o->last_sent_us < recovery_start_us) win.mark_oldest_lost();
+                        }
+                        if (!in_recovery && seq_geq(last_ack, recover_seq) &&
+                            (dup_ack_cnt >= RDT_DUPTHRESH || win.lost() > 0)) {
+                            // 快速重传: enter recovery; the fill loop resends every lost
+                            // segment while pipe < cwnd, oldest first
+                            in_recovery = true;
+                            recover_seq = next_seq;
+                            recovery_start_us = t;
+                            fast_retx++;
+                            win.mark_oldest_lost();
+                            cc->on_loss(t);
+                            if (verbose) log("Fast Retransmit: dupACK=%d lost=%d -> recovery until %u, cwnd=%d ssthresh=%d",
+                                dup_ack_cnt, win.lost(), recover_seq, cc->cwnd(), cc->ssthresh());
+                        }
+
+                        // ====== Congestion control growth ======
+                        // The receiver coalesces ACKs, so one ACK may cover several
+                        // segments: controllers grow by bytes acked, not per ACK.
+                        if (newly > 0 || sample.bytes > 0) {
+                            AckEvent ev;
+                            ev.acked = newly;
+                            ev.delivered = sample.bytes;
+                            ev.inflight = win.inflight();
+                            ev.now_us = t;
+                            cc->on_ack(ev);
+                        }
+                        if (newly == 0) cc->on_dupack(dup_ack_cnt);
+                        note_cwnd();
+                        if (verbose && newly > 0) {
+                            log("ACK advance to %u, %s cwnd=%d ssthresh=%d", ackno, cc->phase(), cc->cwnd(), cc->ssthresh());
+                        }
+                    }
+
+                    if (fin_sent && (h.flags & F_ACK) && h.ack == next_seq + 1) {
+                        fin_acked = true;
+                        log("FIN ACKed (ack=%u). Waiting peer FIN...", h.ack);
+                    }
+                }
+            }
+        } while (!done && nrx == RDT_BATCH);
+
+        if (done) break;
+        uint64_t t = now_us();
+
+        // ====== Timeout (oldest unacked) ======
+        // RTO: everything still unacked is presumed lost; the fill loop then
+        // resends it in order as the collapsed cwnd reopens.
+        if (OutSeg* oldest = win.oldest_unacked()) {
+            if (t - oldest->last_sent_us >= rto.rto()) {
+                uint32_t seq = oldest->seq;
+                rto.on_timeout();
+                rto_count++;
+
+                // ====== Congestion control reaction on timeout ======
+                cc->on_timeout(t);
+                dup_ack_cnt = 0;
+                in_recovery = false;
+                recover_seq = next_seq;   // no fast recovery until this flight is acked
+                int marked = win.lost();
+                win.mark_all_lost();
+                rto_sweep += (uint64_t)std::max(0, win.lost() - marked - 1);
+                note_cwnd();  // Record cwnd change (timeout)
+                tr.ev(TR_TIMEOUT, seq, (uint32_t)rto.rto(), (uint16_t)std::min(win.lost(), 0xFFFF));
+
+                if (verbose) log("TIMEOUT -> seq=%u, %d segments marked lost, cwnd=%d ssthresh=%d rto=%.1f ms",
+                    seq, win.lost(), cc->cwnd(), cc->ssthresh(), rto.rto() / 1000.0);
+            }
+        }
+
+        // ====== Zero-window probe: a bare ACK the receiver answers with its window ======
+        if (probe_at != 0 && t >= probe_at) {
+            RdtHeader probe{};
+            probe.seq = next_seq;
+            probe.ack = peer_isn + 1;
+            probe.flags = F_ACK;
+            probe.wnd = adv_wnd;
+            probe.len = 0;
+            probe.conn = conn_id;
+            send_pkt(sock, peer, probe, nullptr);
+            probes++;
+            probe_at = t + rto.rto();
+            if (verbose) log("Window probe (peerWnd=%u)", peer_wnd);
+        }
+
+        // ====== FIN retransmission (handshake-like) ======
+        if (fin_sent && !fin_acked) {
+            if (t - fin_last >= rto.rto()) {
+                if (fin_retx++ > RDT_MAX_RETX) die("FIN not acked (too many retries)");
+                rto.on_timeout();
+                RdtHeader fin{};
+                fin.seq = next_seq;
+                fin.ack = 0;
+                fin.flags = F_FIN;
+                fin.wnd = adv_wnd;
+                fin.len = 0;
+                fin.conn = conn_id;
+                send_pkt(sock, peer, fin, nullptr);
+                fin_last = t;
+                log("RETX FIN(seq=%u) retx=%d", fin.seq, fin_retx);
+            }
+        }
+    }
+
+    uint64_t end_ms = now_ms();
+    double sec = (end_ms - start_ms) / 1000.0;
+    double throughput = (file_off / 1024.0 / 1024.0) / std::max(1e-9, sec);
+    log("Transfer done. bytes=%llu time=%.3f s, avg throughput=%.3f MB/s",
+        (unsigned long long)file_off, sec, throughput);
+    log("RTT: srtt=%.3f ms rttvar=%.3f ms rto=%.3f ms (%llu samples)",
+        std::max<int64_t>(rto.srtt_us, 0) / 1000.0, rto.rttvar_us / 1000.0, rto.rto() / 1000.0,
+        (unsigned long long)rto.samples);
+    log("Loss recovery: %llu fast recoveries, %llu timeouts, %llu segments retransmitted",
+        (unsigned long long)fast_retx, (unsigned long long)rto_count, (unsigned long long)retx_segs);
+    log("Pacing: final rate=%.3f MB/s, %llu pacer waits",
+        pacer.rate() / 1024.0 / 1024.0, (unsigned long long)pacer.waits());
+    if (probes > 0) log("Flow control: %llu zero-window probes", (unsigned long long)probes);
+    log("Connection: %.3f s from the first SYN to done%s", (end_ms - syn_first_ms) / 1000.0,
+        syn_acked > 0 ? " (fast open)" : "");
+    if (fec.on()) {
+        log("FEC: %llu parity segments for %llu DATA segments (%.1f%%), %llu lost segments rebuilt by the receiver, "
+            "K=%d at the end (loss estimate %.2f%%)", (unsigned long long)fec.parity(), (unsigned long long)fec.sent(),
+            100.0 * fec.parity() / std::max<uint64_t>(1, fec.sent()), (unsigned long long)fec_rebuilt, fec.k(),
+            100.0 * fec.loss());
+    }
+    log("MSS: %d agreed, %d in use (%llu path MTU probes, %llu lost)", agreed_mss, mss,
+        (unsigned long long)pmtu.probes(), (unsigned long long)pmtu.lost());
+    log("I/O: tx %llu pkts in %llu calls (%.2f pkts/syscall), rx %llu pkts in %llu calls (%.2f pkts/syscall)",
+        (unsigned long long)io.tx_pkts, (unsigned long long)io.tx_calls, io.tx_per_call(),
+        (unsigned long long)io.rx_pkts, (unsigned long long)io.rx_calls, io.rx_per_call());
+    log("Trace: %llu tx, %llu rx, %llu acks, %llu sack, %llu cwnd changes; RTT p50<%.3f ms p99<%.3f ms",
+        (unsigned long long)tr.count(TR_TX), (unsigned long long)tr.count(TR_RX),
+        (unsigned long long)tr.count(TR_ACK), (unsigned long long)tr.count(TR_SACK),
+        (unsigned long long)tr.count(TR_CWND), tr.rtt_quantile(0.5) / 1000.0, tr.rtt_quantile(0.99) / 1000.0);
+    if (!cfg_.trace_path.empty() && cfg_.trace_level > 0) {
+        if (tr.dump(cfg_.trace_path))
+            log("Trace: %llu records (%llu overwritten) -> %s", (unsigned long long)tr.records(),
+                (unsigned long long)tr.dropped(), cfg_.trace_path.c_str());
+        else
+            log("Trace: cannot write %s", cfg_.trace_path.c_str());
+    }
+
+    stats_.bytes = file_off;
+    stats_.sec = sec;
+    stats_.srtt_us = std::max<int64_t>(rto.srtt_us, 0);
+    stats_.fast_retx = fast_retx;
+    stats_.rto_count = rto_count;
+    stats_.retx_segs = retx_segs;
+    stats_.tx_pkts = io.tx_pkts;
+    stats_.mss = mss;
+    stats_.syn_data = syn_acked;
+    stats_.total_sec = (end_ms - syn_first_ms) / 1000.0;
+    stats_.fec_parity = fec.parity();
+    stats_.fec_rebuilt = fec_rebuilt;
+    stats_.fec_k = fec.on() ? fec.k() : 0;
+
+    closesocket(sock);
+}
@@ -0,0 +1,266 @@
+#pragma once
+// Deterministic discrete-event simulator: one sender and one receiver in one
+// thread on a virtual clock.
+//
+// The Simulator installs itself as the VirtualNet (rdt.h), then runs the
+// unchanged SendConnection::run(). Every time the sender waits on its socket
+// the simulator jumps the clock to the next event (a packet leaving the
+// link, a receiver timer) instead of sleeping, and drives a RecvConnection
+// exactly as receiver.cpp's event loop does. The link is rdt_link.h's
+// Direction pair, as in rdt_netem. ISNs and every impairment draw come from
+// one generator seeded per run, so a seed replays its run bit for bit
+// (SimResult::digest hashes every delivered packet with its arrival time).
+#include "rdt.h"
+#include "rdt_link.h"
+#include "rdt_input.h"
+#include "rdt_output.h"
+#include "rdt_sender.h"
+#include "rdt_receiver.h"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <queue>
+
+struct SimConfig {
+    SenderConfig snd;          // addresses are ignored
+    ReceiverConfig rcv;
+    Impair fwd, rev;           // sender->receiver (DATA), receiver->sender (ACK)
+    uint64_t seed = 1;
+    bool verbose = false;      // LOG() output of both ends, virtual timestamps
+};
+
+struct SimResult {
+    bool ok = false;           // every byte arrived intact and both ends closed
+    uint64_t bytes = 0;
+    uint64_t time_us = 0;      // virtual time from the first SYN until the sender is done
+    SenderStats snd;
+    DirStats fwd, rev;
+    uint64_t events = 0;       // packet deliveries + receiver timer runs
+    uint64_t digest = 0;
+
+    // no goodput for a run that took no virtual time (a link without delay)
+    bool timed() const { return time_us > 0; }
+    double mbps() const { return timed() ? bytes / 1024.0 / 1024.0 / (time_us / 1e6) : 0.0; }
+};
+
+class Simulator : public VirtualNet {
+public:
+    explicit Simulator(const SimConfig& cfg)
+        : cfg_(cfg), rng_(cfg.seed), fwd_(cfg.fwd, rng_), rev_(cfg.rev, rng_) {
+        quiet = !cfg.verbose;
+    }
+
+    // One transfer of data[0, size). The simulator is single-use.
+    SimResult run(const uint8_t* data, size_t size) {
+        VirtualNet* prev = virtual_net();
+        virtual_net() = this;
+
+        SimResult res;
+        MemoryInput in(data, size);
+        SenderConfig sc = cfg_.snd;
+        sc.client_ip = "127.0.0.1";   // a real socket is opened, but never carries a packet
+        sc.client_port = 0;
+        sc.router_ip = "127.0.0.1";
+        sc.router_port = 9;
+        uint64_t t0 = now_;
+        {
+            SendConnection snd(sc, in, "[sender]");
+            snd.run();
+            res.time_us = now_ - t0;
+            res.snd = snd.stats();
+        }
+
+        // the receiver still has its FIN exchange (or retries) to finish
+        while (conn_ && !conn_->closed()) {
+            uint64_t t = next_time();
+            if (t == UINT64_MAX) break;
+            now_ = std::max(now_, t);
+            run_due();
+        }
+
+        res.bytes = size;
+        res.ok = conn_ && conn_->closed() && out_->memory().size() == size &&
+                 (size == 0 || std::memcmp(out_->memory().data(), data, size) == 0);
+        res.fwd = fwd_.stats;
+        res.rev = rev_.stats;
+        res.events = events_;
+        res.digest = digest_;
+        conn_.reset();
+        virtual_net() = prev;
+        return res;
+    }
+
+    // ====== VirtualNet ======
+    uint64_t now_us() override { return now_; }
+    uint32_t random() override { return (uint32_t)rng_(); }
+
+    // The sender is the only caller: advance the clock event by event until
+    // a packet is waiting for it or the timeout has passed.
+    int wait(SOCKET s, int timeout_ms) override {
+        (void)s;
+        uint64_t until = timeout_ms < 0 ? UINT64_MAX : now_ + (uint64_t)timeout_ms * 1000;
+        for (;;) {
+            run_due();
+            if (!inbox_.empty()) return 1;
+            uint64_t t = next_time();
+            if (t > until) {
+                if (until == UINT64_MAX) die("simulator: sender waits with no event pending");
+                now_ = until;
+                return 0;
+            }
+            now_ = t;
+        }
+    }
+
+    // Packets from the receiver's (virtual) socket go to the sender; all
+    // others are the sender's and go to the receiver.
+    int send(SOCKET s, const sockaddr_in& to, const uint8_t* head, size_t hlen,
+             const uint8_t* payload, size_t len) override {
+        (void)to;
+        bool to_recv = s != RECV_SOCK;
+        Direction& d = to_recv ? fwd_ : rev_;
+        int n = (int)(hlen + len);
+        if (n > RDT_MAX_PKT) return SOCKET_ERROR;   // EMSGSIZE
+        d.stats.rx++;
+        if (d.too_big(n)) {
+            d.stats.too_big++;
+            return n;
+        }
+        if (d.drop()) {
+            d.stats.lost++;
+            return n;
+        }
+        int copies = d.duplicate() ? 2 : 1;
+        if (copies == 2) d.stats.dups++;
+        for (int c = 0; c < copies; c++) {
+            uint64_t due = d.schedule(now_, n);
+            if (due == 0) continue;
+            int i = alloc();
+            SimPkt& p = pool_[i];
+            p.to_recv = to_recv;
+            p.len = n;
+            p.data.resize((size_t)n);
+            std::memcpy(p.data.data(), head, hlen);
+            if (len > 0) std::memcpy(p.data.data() + hlen, payload, len);
+            line_.push(Ev{due, order_++, i});
+        }
+        return n;
+    }
+
+    int recv(SOCKET s, uint8_t* buf, int cap, sockaddr_in& from) override {
+        (void)s;
+        if (inbox_.empty()) return -1;
+        int i = inbox_.front();
+        inbox_.pop_front();
+        int n = std::min(pool_[i].len, cap);
+        std::memcpy(buf, pool_[i].data.data(), (size_t)n);
+        from = make_addr("127.0.0.1", 9);
+        free_.push_back(i);
+        return n;
+    }
+
+private:
+    static constexpr SOCKET RECV_SOCK = INVALID_SOCKET;   // the receiver's socket: never a real one
+
+    struct SimPkt {
+        bool to_recv;
+        int len;
+        std::vector<uint8_t> data;   // keeps its capacity when the slot is reused
+    };
+    struct Ev {
+        uint64_t due;
+        uint64_t order;   // FIFO among packets due at the same time
+        int pkt;
+        bool operator>(const Ev& o) const { return due != o.due ? due > o.due : order > o.order; }
+    };
+
+    int alloc() {
+        if (free_.empty()) {
+            pool_.emplace_back();
+            return (int)pool_.size() - 1;
+        }
+        int i = free_.back();
+        free_.pop_back();
+        return i;
+    }
+
+    // Next time something happens: a delivery or a receiver timer (a timer
+    // already due but idle is retried a microsecond later, so time moves).
+    uint64_t next_time() const {
+        uint64_t t = line_.empty() ? UINT64_MAX : line_.top().due;
+        if (conn_ && !conn_->closed()) t = std::min(t, std::max(conn_->deadline(), now_ + 1));
+        return t;
+    }
+
+    // Everything due at now_: deliveries, then the receiver's timers, again
+    // while that produced packets due right away (zero-delay link).
+    void run_due() {
+        for (;;) {
+            while (!line_.empty() && line_.top().due <= now_) {
+                Ev e = line_.top();
+                line_.pop();
+                deliver(e);
+            }
+            if (conn_ && !conn_->closed() && conn_->deadline() <= now_) {
+                conn_->on_timer(now_);
+                events_++;
+            }
+            if (line_.empty() || line_.top().due > now_) return;
+        }
+    }
+
+    void deliver(const Ev& e) {
+        SimPkt& p = pool_[e.pkt];
+        events_++;
+        // FNV-1a over arrival time, direction and the wire header (checksum included)
+        hash(&e.due, sizeof(e.due));
+        hash(&p.to_recv, sizeof(p.to_recv));
+        hash(p.data.data(), std::min<size_t>((size_t)p.len, sizeof(RdtHeader)));
+        (p.to_recv ? fwd_ : rev_).stats.tx++;
+        if (!p.to_recv) {
+            inbox_.push_back(e.pkt);
+            return;
+        }
+        to_receiver(p);
+        free_.push_back(e.pkt);
+    }
+
+    // receiver.cpp's event loop for one packet: the first SYN opens the connection
+    void to_receiver(SimPkt& p) {
+        RdtHeader h{};
+        RdtOptions opt;
+        uint8_t* payload = nullptr;
+        if (!parse_pkt(p.data.data(), p.len, h, opt, payload)) return;
+        if (!conn_) {
+            if (!(h.flags & F_SYN)) return;
+            out_ = std::make_shared<OutputFd>();
+            std::shared_ptr<OutputFd> out = out_;
+            conn_.reset(new RecvConnection(RECV_SOCK, make_addr("127.0.0.1", 1), h.conn, [out]() { return out; }, 0,
+                                           cfg_.rcv, rio_, "[receiver]"));
+        }
+        conn_->on_packet(h, opt, payload);
+        conn_->flush();
+    }
+
+    void hash(const void* p, size_t n) {
+        const uint8_t* b = (const uint8_t*)p;
+        for (size_t i = 0; i < n; i++) digest_ = (digest_ ^ b[i]) * 1099511628211ULL;
+    }
+
+    SimConfig cfg_;
+    std::mt19937_64 rng_;
+    Direction fwd_, rev_;
+    uint64_t now_ = 1000000;   // 1 s: 0 means "unset" to some timers
+    uint64_t order_ = 0;
+    uint64_t events_ = 0;
+    uint64_t digest_ = 14695981039346656037ULL;
+
+    std::deque<SimPkt> pool_;   // grows without moving packets (a payload may be in use)
+    std::vector<int> free_;
+    std::priority_queue<Ev, std::vector<Ev>, std::greater<Ev>> line_;
+    std::deque<int> inbox_;   // delivered to the sender, not yet read
+
+    std::shared_ptr<OutputFd> out_;
+    std::unique_ptr<RecvConnection> conn_;
+    IoStats rio_;
+};
@@ -0,0 +1,139 @@
+#pragma once
+// Binary event tracer and counters for the send path.
+//
+// Events are 16-byte records in a ring allocated once up front; recording
+// one is a counter increment, a clock read and a few stores, so tracing
+// does not distort the timings it measures the way printf does. When the
+// ring wraps the oldest records are overwritten (and counted as dropped).
+// Per-type counters and an RTT histogram are kept at every level.
+//
+// Levels: 0 = counters only, 1 = + cwnd / retransmit / timeout events,
+// 2 = + every tx / rx / ack / sack / rtt. RDT_TRACE_MAX caps the level at
+// compile time; 0 compiles every record out.
+//
+// dump() writes the file plot_cwnd.py reads (host byte order):
+//   "RDTTRC1\0", u32 record size, u32 event types, u64 records, u64 dropped,
+//   u64 count[event types], u64 rtt_hist[TRACE_RTT_BUCKETS], records...
+#include "rdt.h"
+
+#ifndef RDT_TRACE_MAX
+#define RDT_TRACE_MAX 2
+#endif
+
+enum TraceEv : uint8_t {
+    TR_TX,        // a=seq      b=len
+    TR_RX,        // a=ack      b=wnd field       x=flags
+    TR_ACK,       // a=ackno    b=bytes newly acked  x=dupACK count
+    TR_SACK,      // a=start    b=end (first block)  x=blocks
+    TR_RETX,      // a=seq      b=len             x=retransmissions of the segment
+    TR_CWND,      // a=cwnd     b=ssthresh        x=1 in recovery
+    TR_RTT,       // a=sample   b=srtt (us)
+    TR_TIMEOUT,   // a=seq      b=rto (us)        x=segments marked lost
+    TR_NEV
+};
+
+// RTT histogram: 4 linear sub-buckets per power of two (<= 25% wide) up to 2^32 us
+static constexpr int TRACE_RTT_BUCKETS = 128;
+
+static inline int rtt_bucket(uint32_t us) {
+    if (us < 4) return (int)us;
+    int e = 31;
+    while (!(us >> e)) e--;
+    return 4 * (e - 1) + (int)((us >> (e - 2)) & 3);
+}
+
+// exclusive upper edge (us) of bucket i
+static inline uint64_t rtt_bucket_edge(int i) {
+    if (i < 4) return (uint64_t)i + 1;
+    return (uint64_t)(5 + i % 4) << (i / 4 - 1);
+}
+
+struct TraceRec {
+    uint32_t t_us;   // since the tracer was created
+    uint8_t ev;
+    uint8_t pad;
+    uint16_t x;
+    uint32_t a, b;
+};
+
+class Tracer {
+public:
+    static constexpr size_t CAPACITY = 1 << 18;   // records (4 MB)
+
+    explicit Tracer(int level) : level_(std::max(0, std::min(level, RDT_TRACE_MAX))), t0_(now_us()) {
+        if (level_ > 0) ring_.resize(CAPACITY);
+        std::memset(count_, 0, sizeof(count_));
+        std::memset(hist_, 0, sizeof(hist_));
+    }
+
+    void ev(TraceEv e, uint32_t a, uint32_t b, uint16_t x = 0) {
+        count_[e]++;
+#if RDT_TRACE_MAX > 0
+        if (min_level(e) > level_) return;
+        TraceRec& r = ring_[head_++ & (CAPACITY - 1)];
+        r.t_us = (uint32_t)(now_us() - t0_);
+        r.ev = e;
+        r.pad = 0;
+        r.x = x;
+        r.a = a;
+        r.b = b;
+#else
+        (void)a; (void)b; (void)x;
+#endif
+    }
+
+    void rtt(int64_t sample_us, int64_t srtt_us) {
+        uint32_t s = (uint32_t)std::max<int64_t>(0, std::min<int64_t>(sample_us, UINT32_MAX));
+        hist_[rtt_bucket(s)]++;
+        ev(TR_RTT, s, (uint32_t)std::max<int64_t>(srtt_us, 0));
+    }
+
+    uint64_t count(TraceEv e) const { return count_[e]; }
+    uint64_t records() const { return std::min<uint64_t>(head_, CAPACITY); }
+    uint64_t dropped() const { return head_ > CAPACITY ? head_ - CAPACITY : 0; }
+
+    // Upper edge (us) of the histogram bucket holding quantile q of the RTT samples.
+    uint64_t rtt_quantile(double q) const {
+        uint64_t n = 0, seen = 0;
+        for (uint64_t h : hist_) n += h;
+        if (n == 0) return 0;
+        for (int i = 0; i < TRACE_RTT_BUCKETS; i++) {
+            seen += hist_[i];
+            if (seen >= q * n) return rtt_bucket_edge(i);
+        }
+        return rtt_bucket_edge(TRACE_RTT_BUCKETS - 1);
+    }
+
+    bool dump(const std::string& path) const {
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if (!f) return false;
+        uint32_t rec_size = sizeof(TraceRec), nev = TR_NEV;
+        uint64_t n = records(), drop = dropped();
+        std::fwrite("RDTTRC1", 1, 8, f);
+        std::fwrite(&rec_size, sizeof(rec_size), 1, f);
+        std::fwrite(&nev, sizeof(nev), 1, f);
+        std::fwrite(&n, sizeof(n), 1, f);
+        std::fwrite(&drop, sizeof(drop), 1, f);
+        std::fwrite(count_, sizeof(count_), 1, f);
+        std::fwrite(hist_, sizeof(hist_), 1, f);
+        // oldest first: the ring's tail, then its head
+        size_t start = (size_t)(head_ > CAPACITY ? head_ & (CAPACITY - 1) : 0);
+        if (n > 0) {
+            std::fwrite(ring_.data() + start, sizeof(TraceRec), (size_t)n - start, f);
+            std::fwrite(ring_.data(), sizeof(TraceRec), start, f);
+        }
+        return std::fclose(f) == 0;
+    }
+
+private:
+    static int min_level(TraceEv e) {
+        return (e == TR_CWND || e == TR_RETX || e == TR_TIMEOUT) ? 1 : 2;
+    }
+
+    int level_;
+    uint64_t t0_;
+    std::vector<TraceRec> ring_;
+    uint64_t head_ = 0;
+    uint64_t count_[TR_NEV];
+    uint64_t hist_[TRACE_RTT_BUCKETS];
+};
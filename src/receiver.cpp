@@ -1,195 +1,331 @@
 #include "rdt.h"
-#include <map>
+#include "rdt_receiver.h"
 #include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
 
-struct SegmentBuf {
-    std::vector<uint8_t> data;
+// ====== Connection table ======
+// A connection is identified by the peer address plus the conn ID the sender
+// put in its SYN, so one peer can run several uploads at once.
+static inline uint64_t conn_key(const sockaddr_in& from, uint16_t conn) {
+    return ((uint64_t)from.sin_addr.s_addr << 32) | ((uint64_t)from.sin_port << 16) | conn;
+}
+
+struct ServerConfig {
+    ReceiverConfig rc;
+    std::string out_file;
+    bool server = false;   // keep accepting connections (false: exit after one)
+};
+
+// Stripes of one file: same peer IP and stripe file id (ports differ).
+static inline uint64_t stripe_key(const sockaddr_in& from, const StripeInfo& st) {
+    return ((uint64_t)from.sin_addr.s_addr << 32) | st.file;
+}
+
+// Output path of a connection: the given file in single-connection mode,
+// <output_file>.<ip>_<port>_<conn> in server mode, or <output_file>.<ip>_s<file>
+// for all stripes of a striped file. A multi-file session uses the path as
+// the directory its files go to.
+static std::string conn_output(const ServerConfig& cfg, const sockaddr_in& from, uint16_t conn,
+                               const StripeInfo& st, std::string& tag) {
+    uint32_t ip = ntohl(from.sin_addr.s_addr);   // inet_ntoa is not thread-safe
+    char name[64], file[64];
+    std::snprintf(name, sizeof(name), "%u.%u.%u.%u_%u_%04x", ip >> 24, (ip >> 16) & 0xFF,
+                  (ip >> 8) & 0xFF, ip & 0xFF, ntohs(from.sin_port), conn);
+    std::snprintf(file, sizeof(file), "%u.%u.%u.%u_s%08x", ip >> 24, (ip >> 16) & 0xFF,
+                  (ip >> 8) & 0xFF, ip & 0xFF, st.file);
+    tag = std::string();
+    if (cfg.server) tag = std::string("[") + name + "]";
+    else if (st.cnt > 0) tag = "[stripe " + std::to_string(st.idx) + "]";
+    if (!cfg.server) return cfg.out_file;
+    return cfg.out_file + "." + (st.cnt > 0 ? file : name);
+}
+
+// ====== Striped files ======
+// Every stripe of a file writes through one shared OutputFd at its own
+// offset. Stripes arrive on different ports and so may land on different
+// workers; the entry lives until all cnt stripes have closed, so a late
+// stripe never re-creates (truncates) the file. If any stripe was dropped
+// the file is incomplete and the last one out removes it.
+class StripeFiles {
+public:
+    std::shared_ptr<OutputFd> open(uint64_t key, const std::string& path, int cnt) {
+        std::lock_guard<std::mutex> lk(mu_);
+        Entry& e = files_[key];
+        if (!e.fd) {
+            e.fd = std::make_shared<OutputFd>(path);
+            e.remaining = cnt;
+        }
+        return e.fd;
+    }
+
+    void release(uint64_t key, bool aborted) {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = files_.find(key);
+        if (it == files_.end()) return;
+        it->second.aborted |= aborted;
+        if (--it->second.remaining > 0) return;
+        if (it->second.aborted) it->second.fd->discard(0);
+        files_.erase(it);
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<OutputFd> fd;
+        int remaining = 0;
+        bool aborted = false;
+    };
+    std::mutex mu_;
+    std::unordered_map<uint64_t, Entry> files_;
+};
+
+struct ConnSlot {
+    std::unique_ptr<RecvConnection> conn;
+    std::shared_ptr<OutputFd> file;   // once the handshake completed
+    bool striped = false;
+    uint64_t stripe = 0;   // stripe_key() if striped
 };
 
-// Build SACK bitmap for segments after expected_ack
-static uint64_t build_sack_mask(uint32_t expected_ack,
-                               const std::map<uint32_t, SegmentBuf>& ooo) {
-    uint64_t mask = 0;
-    for (int i = 0; i < RDT_SACK_BITS; i++) {
-        uint32_t seq = expected_ack + uint32_t((i + 1) * RDT_MSS);
-        if (ooo.find(seq) != ooo.end()) mask |= (1ull << i);
+// ====== Worker: one socket, its own connections, no shared state ======
+// With SO_REUSEPORT each worker owns a socket bound to the same port and the
+// kernel keeps every peer on one socket, so a connection lives entirely in
+// one thread and the table needs no locks.
+static void run_worker(int id, SOCKET sock, const ServerConfig& cfg, StripeFiles& stripes) {
+    std::unordered_map<uint64_t, ConnSlot> conns;
+    std::vector<RecvConnection*> touched;   // connections with ACKs staged in this burst
+    RxBatch rx;
+    IoStats io;
+
+    // without --server: the first connection, or every stripe of the first striped file
+    uint64_t accepted = 0, finished = 0, expect = 1;
+    uint64_t first_stripe = 0;
+
+    bool done = false;
+    while (!done) {
+        // ====== Wait for a datagram or the next delayed-ACK / FIN deadline ======
+        uint64_t deadline = UINT64_MAX;
+        for (auto& kv : conns) deadline = std::min(deadline, kv.second.conn->deadline());
+        wait_readable(sock, ms_until(deadline, now_us()));
+
+        // ====== Drain every pending datagram, a batch per syscall ======
+        int nrx;
+        do {
+            nrx = recv_batch(sock, rx, io);
+            for (int i = 0; i < nrx; i++) {
+                const sockaddr_in& from = rx.from[i];
+                RdtHeader h{};
+                RdtOptions opt;
+                uint8_t* payload = nullptr;
+                if (!parse_pkt(rx.slot(i), rx.len[i], h, opt, payload)) continue;
+
+                uint64_t key = conn_key(from, h.conn);
+                auto it = conns.find(key);
+                if (it == conns.end()) {
+                    // only a SYN opens a connection
+                    if (!(h.flags & F_SYN)) continue;
+                    const StripeInfo& st = opt.stripe;
+                    uint64_t skey = stripe_key(from, st);
+                    if (!cfg.server) {
+                        if (accepted == 0) {
+                            if (st.cnt > 0) expect = st.cnt;
+                            first_stripe = skey;
+                        } else if (accepted >= expect || st.cnt == 0 || skey != first_stripe) {
+                            continue;
+                        }
+                    }
+
+                    std::string tag;
+                    std::string path = conn_output(cfg, from, h.conn, st, tag);
+                    it = conns.emplace(key, ConnSlot()).first;
+                    ConnSlot* slot = &it->second;   // map nodes do not move
+                    slot->striped = st.cnt > 0;
+                    slot->stripe = skey;
+                    int cnt = st.cnt;
+                    bool session = opt.session >= 0;
+                    OpenOutput open = [slot, &stripes, path, cnt, session]() {
+                        if (slot->striped) slot->file = stripes.open(slot->stripe, path, cnt);
+                        else if (session) slot->file = std::make_shared<SessionOutput>(path);
+                        else slot->file = std::make_shared<OutputFd>(path);
+                        return slot->file;
+                    };
+                    slot->conn.reset(new RecvConnection(sock, from, h.conn, open, st.off, cfg.rc, io, tag));
+                    accepted++;
+                    if (cfg.server) {
+                        LOG("worker %d: new connection %s -> %s (%zu active)",
+                            id, tag.c_str(), path.c_str(), conns.size());
+                    }
+                    if (st.cnt > 0) {
+                        LOG("%s stripe %u/%u of file %08x at offset %llu", tag.c_str(),
+                            st.idx, st.cnt, st.file, (unsigned long long)st.off);
+                    }
+                }
+                RecvConnection* c = it->second.conn.get();
+                c->on_packet(h, opt, payload);
+                if (touched.empty() || touched.back() != c) touched.push_back(c);
+            }
+            // ACKs generated by this burst leave in one batched send per connection
+            for (RecvConnection* c : touched) c->flush();
+            touched.clear();
+        } while (nrx == RDT_BATCH);
+
+        // ====== Timers; retire closed connections ======
+        uint64_t t = now_us();
+        for (auto it = conns.begin(); it != conns.end();) {
+            it->second.conn->on_timer(t);
+            if (it->second.conn->closed()) {
+                // the writer is joined with the connection, then a dropped
+                // transfer's output is removed
+                bool aborted = it->second.conn->aborted();
+                uint64_t received = it->second.conn->received();
+                std::shared_ptr<OutputFd> file = it->second.file;
+                bool striped = it->second.striped;
+                uint64_t stripe = it->second.stripe;
+                it = conns.erase(it);
+                if (file && striped) stripes.release(stripe, aborted);
+                else if (file && aborted) file->discard(received);
+                if (!cfg.server && ++finished == expect) done = true;
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    LOG("I/O: rx %llu pkts in %llu calls (%.2f pkts/syscall), tx %llu pkts in %llu calls (%.2f pkts/syscall)",
+        (unsigned long long)io.rx_pkts, (unsigned long long)io.rx_calls, io.rx_per_call(),
+        (unsigned long long)io.tx_pkts, (unsigned long long)io.tx_calls, io.tx_per_call());
+}
+
+// ====== Fast-open cookie secret ======
+// Kept in a file so cookies stay valid across runs (a sender caches them
+// between its runs); created with a fresh random key the first time.
+static void cookie_key_load(const std::string& path, uint64_t key[2]) {
+    unsigned long long k0 = 0, k1 = 0;
+    if (FILE* f = std::fopen(path.c_str(), "r")) {
+        bool ok = std::fscanf(f, "%llx %llx", &k0, &k1) == 2;
+        std::fclose(f);
+        if (ok) {
+            key[0] = k0;
+            key[1] = k1;
+            return;
+        }
+    }
+    key[0] = (uint64_t)rdt_isn() << 32 | rdt_isn();
+    key[1] = (uint64_t)rdt_isn() << 32 | rdt_isn();
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        LOG("Fast open: cannot write %s, cookies last for this run only", path.c_str());
+        return;
     }
-    return mask;
+    std::fprintf(f, "%016llx %016llx\n", (unsigned long long)key[0], (unsigned long long)key[1]);
+    std::fclose(f);
 }
 
 int main(int argc, char** argv) {
-    if (argc < 5) {
-        std::printf("Usage: receiver.exe <bind_ip> <bind_port> <output_file> <fixed_wnd_segments>\n");
+    if (argc < 5 || std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0) {
+        std::printf("Usage: receiver.exe <bind_ip> <bind_port> <output_file> <fixed_wnd_segments> [options]\n");
+        std::printf("Options:\n");
+        std::printf("  --ack-every=N    ACK every N in-order segments (default %d, 1 = every segment)\n", RDT_ACK_EVERY);
+        std::printf("  --delack-ms=M    delayed-ACK timer in ms (default %d)\n", RDT_DELACK_MS);
+        std::printf("  --mss=N          largest segment payload accepted, answered to the sender's offer (default %d)\n", RDT_MAX_MSS);
+        std::printf("  --server         keep accepting connections; each writes <output_file>.<ip>_<port>_<conn>\n");
+        std::printf("                   (a multi-file session from sender --session writes its files under that path as a directory)\n");
+        std::printf("  --workers=N      server worker threads, one SO_REUSEPORT socket each (default 1)\n");
+        std::printf("  --fec=0|1        rebuild lost segments from the sender's parity segments (default 1)\n");
+        std::printf("  --fastopen=0|1   issue fast-open cookies and take data in SYNs that carry one (default 1)\n");
+        std::printf("  --cookie-key-file=PATH   cookie secret, created on first use (default rdt_cookie_key.txt)\n");
         return 0;
     }
+    static const char* const options[] = {"ack-every", "delack-ms", "mss", "server", "workers",
+                                          "fec", "fastopen", "cookie-key-file"};
+    if (const char* a = unknown_option(argc, argv, 5, options)) {
+        std::printf("ERROR: unknown option %s (see --help)\n", a);
+        return 1;
+    }
+    ServerConfig cfg;
     std::string bind_ip  = argv[1];
     int bind_port        = std::atoi(argv[2]);
-    std::string out_file = argv[3];
-    int fixed_wnd        = std::atoi(argv[4]);
+    cfg.out_file         = argv[3];
+    cfg.rc.fixed_wnd     = std::max(1, std::min(std::atoi(argv[4]), RDT_MAX_WND));
+
+    // ====== ACK policy ======
+    if (const char* v = opt_value(argc, argv, 5, "ack-every")) cfg.rc.ack_every = std::max(1, std::atoi(v));
+    if (const char* v = opt_value(argc, argv, 5, "delack-ms")) cfg.rc.delack_ms = std::max(0, std::atoi(v));
+    if (const char* v = opt_value(argc, argv, 5, "mss")) cfg.rc.mss = std::max(1, std::min(std::atoi(v), RDT_MAX_MSS));
+
+    // ====== FEC ======
+    if (const char* v = opt_value(argc, argv, 5, "fec")) cfg.rc.fec = std::atoi(v) != 0;
+
+    // ====== Fast open ======
+    if (const char* v = opt_value(argc, argv, 5, "fastopen")) cfg.rc.fastopen = std::atoi(v) != 0;
+    if (cfg.rc.fastopen) {
+        std::string key_file = "rdt_cookie_key.txt";
+        if (const char* v = opt_value(argc, argv, 5, "cookie-key-file")) key_file = v;
+        cookie_key_load(key_file, cfg.rc.cookie_key);
+    }
+
+    // ====== Server mode ======
+    cfg.server = opt_flag(argc, argv, 5, "server");
+    int workers = 1;
+    if (const char* v = opt_value(argc, argv, 5, "workers")) workers = std::max(1, std::atoi(v));
+    if (!cfg.server) workers = 1;
+    // a server runs until killed: do not let its log sit in a stdio buffer
+    if (cfg.server) std::setvbuf(stdout, nullptr, _IOLBF, 1 << 16);
 
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) die("WSAStartup");
 
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == INVALID_SOCKET) die("socket");
-
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_port = htons((uint16_t)bind_port);
     addr.sin_addr.s_addr = inet_addr(bind_ip.c_str());
-    if (bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0) die("bind");
-    set_nonblocking(sock);
-
-    FILE* fp = std::fopen(out_file.c_str(), "wb");
-    if (!fp) die("cannot open output file");
-
-    LOG("Receiver listening on %s:%d, output=%s, fixedWnd=%d",
-        bind_ip.c_str(), bind_port, out_file.c_str(), fixed_wnd);
-
-    enum { R_CLOSED, R_SYN_RCVD, R_EST, R_FIN_WAIT } state = R_CLOSED;
-
-    sockaddr_in peer{};
-    uint32_t isn_recv    = 1000u + (uint32_t)(now_ms() & 0xFFFF);
-    uint32_t sender_isn  = 0;
-    uint32_t expected_ack = 0;
-
-    std::map<uint32_t, SegmentBuf> ooo;
-    uint64_t start_ms = 0;
-
-    while (true) {
-        uint8_t buf[RDT_MAX_PKT];
-        sockaddr_in from{};
-        int fromlen = sizeof(from);
-        int n = recvfrom(sock, (char*)buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
-
-        if (n >= (int)sizeof(RdtHeader)) {
-            RdtHeader h{};
-            std::memcpy(&h, buf, sizeof(RdtHeader));
-            ntoh_header(h);
-
-            uint8_t* payload = buf + sizeof(RdtHeader);
-            if (h.len > 0 && (int)(sizeof(RdtHeader) + h.len) > n) continue;
-            if (!verify_checksum(h, payload)) continue;
-
-            // only accept one peer (router will be the peer in router environment)
-            if (state == R_CLOSED) {
-                if (h.flags & F_SYN) {
-                    peer = from;
-                    sender_isn = h.seq;
-                    expected_ack = sender_isn + 1;
-                    state = R_SYN_RCVD;
-
-                    RdtHeader synack{};
-                    synack.seq = isn_recv;
-                    synack.ack = expected_ack;
-                    synack.flags = F_SYN | F_ACK;
-                    synack.wnd = (uint16_t)fixed_wnd;
-                    synack.len = 0;
-                    synack.sack_mask = 0;
-
-                    send_pkt(sock, peer, synack, nullptr);
-                    LOG("RX SYN(seq=%u) -> TX SYN|ACK(seq=%u, ack=%u)", sender_isn, isn_recv, expected_ack);
-                }
-                Sleep(1);
-                continue;
-            } else {
-                if (from.sin_addr.s_addr != peer.sin_addr.s_addr || from.sin_port != peer.sin_port) {
-                    Sleep(1);
-                    continue;
-                }
-            }
 
-            if (state == R_SYN_RCVD) {
-                if ((h.flags & F_ACK) && h.ack == (isn_recv + 1)) {
-                    state = R_EST;
-                    start_ms = now_ms();
-                    LOG("Connection established.");
-                }
-                Sleep(1);
-                continue;
-            }
+    int sockbuf = 0;
+    auto open_socket = [&](bool reuse) -> SOCKET {
+        SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sock == INVALID_SOCKET) die("socket");
+        if (reuse && !set_reuseport(sock)) {
+            closesocket(sock);
+            return INVALID_SOCKET;
+        }
+        if (bind(sock, (sockaddr*)&addr, sizeof(addr)) != 0) die("bind");
+        set_nonblocking(sock);
+        sockbuf = set_socket_buffers(sock, (uint64_t)cfg.rc.fixed_wnd * cfg.rc.mss);
+        return sock;
+    };
 
-            if (state == R_EST) {
-                if (h.flags & F_FIN) {
-                    // ACK peer FIN
-                    RdtHeader ack{};
-                    ack.seq = isn_recv + 1;
-                    ack.ack = h.seq + 1;
-                    ack.flags = F_ACK;
-                    ack.wnd = (uint16_t)fixed_wnd;
-                    ack.len = 0;
-                    ack.sack_mask = 0;
-                    send_pkt(sock, peer, ack, nullptr);
-                    LOG("RX FIN(seq=%u) -> TX ACK(ack=%u)", h.seq, ack.ack);
-
-                    // send our FIN
-                    RdtHeader fin{};
-                    fin.seq = isn_recv + 2;
-                    fin.ack = expected_ack;
-                    fin.flags = F_FIN | F_ACK;
-                    fin.wnd = (uint16_t)fixed_wnd;
-                    fin.len = 0;
-                    fin.sack_mask = 0;
-                    send_pkt(sock, peer, fin, nullptr);
-                    LOG("TX FIN(seq=%u, ack=%u)", fin.seq, fin.ack);
-
-                    state = R_FIN_WAIT;
-                    Sleep(1);
-                    continue;
-                }
+    std::vector<SOCKET> socks;
+    for (int i = 0; i < workers; i++) {
+        SOCKET sock = open_socket(workers > 1);
+        if (sock == INVALID_SOCKET) {
+            // no kernel flow steering: a single worker serves every connection
+            LOG("SO_REUSEPORT unavailable, using 1 worker");
+            for (SOCKET s : socks) closesocket(s);
+            socks.clear();
+            break;
+        }
+        socks.push_back(sock);
+    }
+    if (socks.empty()) socks.push_back(open_socket(false));
 
-                if (h.flags & F_DATA) {
-                    if (h.seq == expected_ack) {
-                        std::fwrite(payload, 1, h.len, fp);
-                        expected_ack += h.len;
-
-                        while (true) {
-                            auto it = ooo.find(expected_ack);
-                            if (it == ooo.end()) break;
-                            std::fwrite(it->second.data.data(), 1, it->second.data.size(), fp);
-                            expected_ack += (uint32_t)it->second.data.size();
-                            ooo.erase(it);
-                        }
-                    } else if (h.seq > expected_ack) {
-                        uint32_t max_seq = expected_ack + (uint32_t)(fixed_wnd * RDT_MSS);
-                        if (h.seq < max_seq) {
-                            if (ooo.find(h.seq) == ooo.end()) {
-                                SegmentBuf sb;
-                                sb.data.assign(payload, payload + h.len);
-                                ooo[h.seq] = std::move(sb);
-                            }
-                        }
-                    } else {
-                        // duplicate old segment; ignore payload
-                    }
+    LOG("Receiver listening on %s:%d, output=%s, fixedWnd=%d, ackEvery=%d, delack=%d ms, mss<=%d, sockbuf=%d KB",
+        bind_ip.c_str(), bind_port, cfg.out_file.c_str(), cfg.rc.fixed_wnd, cfg.rc.ack_every,
+        cfg.rc.delack_ms, cfg.rc.mss, sockbuf / 1024);
+    if (cfg.server) LOG("Server mode: %d worker(s)", (int)socks.size());
 
-                    // send ACK + SACK
-                    RdtHeader ack{};
-                    ack.seq = isn_recv + 1;
-                    ack.ack = expected_ack;
-                    ack.flags = F_ACK;
-                    ack.wnd = (uint16_t)fixed_wnd;
-                    ack.len = 0;
-                    ack.sack_mask = build_sack_mask(expected_ack, ooo);
-                    send_pkt(sock, peer, ack, nullptr);
-
-                    // logging (optional: keep concise)
-                    // LOG("TX ACK(ack=%u, sack=0x%08X)", expected_ack, ack.sack_mask);
-                }
-            } else if (state == R_FIN_WAIT) {
-                if (h.flags & F_ACK) {
-                    uint64_t end_ms = now_ms();
-                    LOG("Connection closed. Receive time = %.3f s", (end_ms - start_ms) / 1000.0);
-                    break;
-                }
-            }
+    StripeFiles stripes;
+    if (socks.size() == 1) {
+        run_worker(0, socks[0], cfg, stripes);
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < socks.size(); i++) {
+            threads.emplace_back(run_worker, (int)i, socks[i], std::cref(cfg), std::ref(stripes));
         }
-
-        Sleep(1);
+        for (auto& th : threads) th.join();
     }
 
-    std::fclose(fp);
-    closesocket(sock);
+    for (SOCKET s : socks) closesocket(s);
     WSACleanup();
     return 0;
 }
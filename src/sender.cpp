@@ -1,434 +1,270 @@
 #include "rdt.h"
-#include <map>
-#include <vector>
-#include <algorithm>
-#include <fstream>
+#include "rdt_sender.h"
+#include <memory>
+#include <thread>
 
-// ====== CWND logging for plotting ======
-static std::ofstream cwnd_log_file;
-
-static void cwnd_log_init() {
-    cwnd_log_file.open("cwnd_log.csv", std::ios::out | std::ios::trunc);
-    if (cwnd_log_file.is_open()) {
-        cwnd_log_file << "time_ms,cwnd\n";
-    }
-}
-
-static void cwnd_log_record(int cwnd_value) {
-    if (cwnd_log_file.is_open()) {
-        uint64_t t = now_ms();
-        cwnd_log_file << t << "," << cwnd_value << "\n";
-    }
-}
-
-static void cwnd_log_close() {
-    if (cwnd_log_file.is_open()) {
-        cwnd_log_file.close();
-    }
-}
-
-static void cwnd_plot_generate() {
+// ====== CWND plot (binary trace -> PNG), only with --plot ======
+static void cwnd_plot_generate(const std::string& trace, const std::string& png) {
     // Generate the plot using Python script (safe in experiment environment)
-    int ret = std::system("python plot_cwnd.py cwnd_log.csv cwnd_curve.png");
+    std::string args = " plot_cwnd.py " + trace + " " + png;
+    std::fflush(stdout);   // our buffered log must not interleave with the child's output
+    int ret = std::system(("python" + args).c_str());
     if (ret != 0) {
         // Try python3 if python doesn't work
-        ret = std::system("python3 plot_cwnd.py cwnd_log.csv cwnd_curve.png");
+        ret = std::system(("python3" + args).c_str());
     }
     if (ret == 0) {
-        LOG("CWND curve plot generated: cwnd_curve.png");
+        LOG("CWND curve plot generated: %s", png.c_str());
     } else {
-        LOG("CWND curve data saved to: cwnd_log.csv (run 'python plot_cwnd.py' to generate plot)");
+        LOG("CWND curve data saved to: %s (run 'python plot_cwnd.py' to generate plot)", trace.c_str());
     }
 }
 
-struct OutSeg {
-    uint32_t seq;
-    uint16_t len;
-    std::vector<uint8_t> data;
-    bool acked = false;
-    uint64_t last_sent_ms = 0;
-    int retx = 0;
-};
+// ====== Fast-open cookie cache: one "ip:port cookie" line per receiver ======
+// The key is the address we send to (router_ip:router_port). A missing or
+// unreadable file just means no cookie yet.
+static uint64_t cookie_load(const std::string& path, const std::string& key) {
+    FILE* f = std::fopen(path.c_str(), "r");
+    if (!f) return 0;
+    char k[128];
+    unsigned long long c = 0, found = 0;
+    while (std::fscanf(f, "%127s %llx", k, &c) == 2) {
+        if (key == k) found = c;
+    }
+    std::fclose(f);
+    return (uint64_t)found;
+}
 
-// Mark segments acked by SACK bitmap (relative to cumulative ack)
-static void mark_sack_acked(uint32_t cum_ack, uint64_t sack_mask, std::map<uint32_t, OutSeg>& out) {
-    for (int i = 0; i < RDT_SACK_BITS; i++) {
-        if (sack_mask & (1ull << i)) {
-            uint32_t seq = cum_ack + uint32_t((i + 1) * RDT_MSS);
-            auto it = out.find(seq);
-            if (it != out.end()) it->second.acked = true;
+static void cookie_save(const std::string& path, const std::string& key, uint64_t cookie) {
+    std::vector<std::pair<std::string, unsigned long long>> entries;
+    if (FILE* f = std::fopen(path.c_str(), "r")) {
+        char k[128];
+        unsigned long long c = 0;
+        while (std::fscanf(f, "%127s %llx", k, &c) == 2) {
+            if (key != k) entries.emplace_back(k, c);
         }
+        std::fclose(f);
+    }
+    entries.emplace_back(key, (unsigned long long)cookie);
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) {
+        LOG("Fast open: cannot write cookie cache %s", path.c_str());
+        return;
     }
+    for (const auto& e : entries) std::fprintf(f, "%s %016llx\n", e.first.c_str(), e.second);
+    std::fclose(f);
 }
 
-static sockaddr_in make_addr(const std::string& ip, int port) {
-    sockaddr_in a{};
-    a.sin_family = AF_INET;
-    a.sin_port = htons((uint16_t)port);
-    a.sin_addr.s_addr = inet_addr(ip.c_str());
-    return a;
+// ====== Session report: every file, then the whole session ======
+// A file's time runs from its first byte sent to its last byte acknowledged.
+static void session_report(const SessionInput& in, const SenderStats& st) {
+    const std::vector<SessionFile>& files = in.files();
+    uint64_t bytes = 0;
+    std::vector<double> ms;
+    for (size_t i = 0; i < files.size(); i++) {
+        const SessionFile& f = files[i];
+        bytes += f.size;
+        if (in.done_us(i) == 0) {
+            LOG("File %zu: %s bytes=%llu not completed", i, f.path.c_str(), (unsigned long long)f.size);
+            continue;
+        }
+        double t = (in.done_us(i) - in.start_us(i)) / 1e6;
+        ms.push_back(t * 1000.0);
+        LOG("File %zu: %s bytes=%llu time=%.3f ms throughput=%.3f MB/s", i, f.path.c_str(),
+            (unsigned long long)f.size, t * 1000.0, f.size / 1024.0 / 1024.0 / std::max(t, 1e-9));
+    }
+    std::sort(ms.begin(), ms.end());
+    double sec = std::max(st.sec, 1e-9);
+    LOG("Session done. files=%zu/%zu bytes=%llu time=%.3f s, throughput=%.3f MB/s, %.1f files/s",
+        ms.size(), files.size(), (unsigned long long)bytes, st.sec, bytes / 1024.0 / 1024.0 / sec, ms.size() / sec);
+    if (!ms.empty()) {
+        LOG("Per-file time: p50=%.3f ms p99=%.3f ms max=%.3f ms; manifest %llu bytes (%.2f%% of the stream)",
+            ms[(ms.size() - 1) / 2], ms[(size_t)((ms.size() - 1) * 0.99)], ms.back(),
+            (unsigned long long)in.manifest_bytes(), 100.0 * in.manifest_bytes() / std::max<uint64_t>(1, in.size()));
+    }
+    if (in.changed() > 0) {
+        LOG("Session: %llu files changed while being sent (padded with zeros or cut at their listed size)",
+            (unsigned long long)in.changed());
+    }
 }
 
 int main(int argc, char** argv) {
-    if (argc < 7) {
+    if (argc < 7 || std::strcmp(argv[1], "-h") == 0 || std::strcmp(argv[1], "--help") == 0) {
         std::printf("Usage:\n");
-        std::printf("  sender.exe <client_ip> <client_port> <router_ip> <router_port> <input_file> <fixed_wnd_segments>\n");
+        std::printf("  sender.exe <client_ip> <client_port> <router_ip> <router_port> <input_file> <fixed_wnd_segments> [options]\n");
+        std::printf("Options:\n");
+        std::printf("  --input=read|mmap|stream   how the input is loaded (default stream; \"-\" as input_file streams stdin)\n");
+        std::printf("  --cc=reno|cubic|bbr        congestion controller (default reno)\n");
+        std::printf("  --pace-gain=G              pacing rate = G x controller rate (default 1, 0 = no pacing)\n");
+        std::printf("  --pace-max=MBps            hard cap on the DATA rate in MB/s (default 0 = none)\n");
+        std::printf("  --stripes=K                split the file over K connections on client_port..client_port+K-1\n");
+        std::printf("  --session                  input_file lists files to send over one connection (one path per line, \"-\" = stdin)\n");
+        std::printf("  --mss=N                    largest segment payload offered in the SYN (default %d with probing, else %d)\n", RDT_MAX_MSS, RDT_MSS);
+        std::printf("  --pmtud=0|1                path MTU probing from %d bytes up to the agreed MSS (default 1)\n", RDT_MSS);
+        std::printf("  --fec=auto|K               XOR parity segment per K DATA segments (K<=%d; auto: K follows the loss rate; default 0 = off)\n", RDT_FEC_MAX_K);
+        std::printf("  --fastopen                 send the first segment in the SYN with a cookie cached from an earlier run\n");
+        std::printf("  --cookie-file=PATH         fast-open cookie cache (default rdt_cookies.txt)\n");
+        std::printf("  --trace=0|1|2              binary trace: 0 counters only, 1 + cwnd/retransmit/timeout (default), 2 + every packet\n");
+        std::printf("  --verbose                  also print every retransmission / ACK advance / recovery (slow)\n");
+        std::printf("  --plot                     run plot_cwnd.py on the trace after the transfer\n");
         return 0;
     }
+    static const char* const options[] = {"input", "cc", "pace-gain", "pace-max", "stripes", "session", "mss", "pmtud",
+                                          "fec", "fastopen", "cookie-file", "trace", "verbose", "plot"};
+    if (const char* a = unknown_option(argc, argv, 7, options)) {
+        std::printf("ERROR: unknown option %s (see --help)\n", a);
+        return 1;
+    }
 
-    std::string client_ip = argv[1];
-    int client_port       = std::atoi(argv[2]);
-    std::string router_ip = argv[3];
-    int router_port       = std::atoi(argv[4]);
-    std::string in_file   = argv[5];
-    int fixed_wnd         = std::atoi(argv[6]);
+    SenderConfig cfg;
+    cfg.client_ip       = argv[1];
+    cfg.client_port     = std::atoi(argv[2]);
+    cfg.router_ip       = argv[3];
+    cfg.router_port     = std::atoi(argv[4]);
+    std::string in_file = argv[5];
+    cfg.fixed_wnd       = std::max(1, std::min(std::atoi(argv[6]), RDT_MAX_WND));
+
+    InputMode in_mode = IN_STREAM;
+    if (const char* v = opt_value(argc, argv, 7, "input")) {
+        if (!parse_input_mode(v, in_mode)) die("bad --input (read|mmap|stream)");
+    }
+    if (const char* v = opt_value(argc, argv, 7, "cc")) {
+        if (!parse_cc_algo(v, cfg.cc_algo)) die("bad --cc (reno|cubic|bbr)");
+    }
+    if (const char* v = opt_value(argc, argv, 7, "pace-gain")) cfg.pace_gain = std::max(0.0, std::atof(v));
+    if (const char* v = opt_value(argc, argv, 7, "pace-max")) cfg.pace_max = std::max(0.0, std::atof(v));
+    int stripes = 1;
+    if (const char* v = opt_value(argc, argv, 7, "stripes")) stripes = std::max(1, std::min(std::atoi(v), 255));
+    bool session = opt_flag(argc, argv, 7, "session");
+    if (session && stripes > 1) die("--session and --stripes cannot be combined");
+    if (const char* v = opt_value(argc, argv, 7, "mss")) cfg.mss = std::max(1, std::min(std::atoi(v), RDT_MAX_MSS));
+    if (const char* v = opt_value(argc, argv, 7, "pmtud")) cfg.pmtud = std::atoi(v) != 0;
+    if (const char* v = opt_value(argc, argv, 7, "trace")) cfg.trace_level = std::max(0, std::min(std::atoi(v), 2));
+    cfg.verbose = opt_flag(argc, argv, 7, "verbose");
+    if (const char* v = opt_value(argc, argv, 7, "fec")) {
+        if (!parse_fec(v, cfg.fec)) die("bad --fec (auto|0..16)");
+    }
+    cfg.fastopen = opt_flag(argc, argv, 7, "fastopen");
+    std::string cookie_file = "rdt_cookies.txt";
+    if (const char* v = opt_value(argc, argv, 7, "cookie-file")) cookie_file = v;
+    std::string cookie_key = cfg.router_ip + ":" + std::to_string(cfg.router_port);
+    if (cfg.fastopen) cfg.cookie = cookie_load(cookie_file, cookie_key);
+    bool plot = opt_flag(argc, argv, 7, "plot") && cfg.trace_level > 0;
 
     WSADATA wsa;
     if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) die("WSAStartup");
 
-    SOCKET sock = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sock == INVALID_SOCKET) die("socket");
-    set_nonblocking(sock);
-
-    // IMPORTANT: bind client ip/port (recommended for router env)
-    sockaddr_in local = make_addr(client_ip, client_port);
-    if (bind(sock, (sockaddr*)&local, sizeof(local)) != 0) die("bind(client)");
-    LOG("Sender bind at %s:%d", client_ip.c_str(), client_port);
-
-    // peer is ROUTER
-    sockaddr_in peer = make_addr(router_ip, router_port);
-    LOG("Peer(router) = %s:%d", router_ip.c_str(), router_port);
-
-    // Read file
-    FILE* fp = std::fopen(in_file.c_str(), "rb");
-    if (!fp) die("cannot open input file");
-
-    std::fseek(fp, 0, SEEK_END);
-    long fsz = std::ftell(fp);
-    std::fseek(fp, 0, SEEK_SET);
-
-    std::vector<uint8_t> filedata((size_t)std::max(0L, fsz));
-    if (fsz > 0) std::fread(filedata.data(), 1, (size_t)fsz, fp);
-    std::fclose(fp);
-
-    LOG("File size: %ld bytes", fsz);
-
-    // ====== 3-way handshake ======
-    uint32_t isn_send = 5000u + (uint32_t)(now_ms() & 0xFFFF);
-    uint32_t peer_isn = 0;
-
-    uint32_t base_ack  = isn_send + 1; // data starts from isn+1
-    uint32_t next_seq  = base_ack;
-
-    bool established = false;
-    uint64_t syn_last = 0;
-    int syn_retx = 0;
-
-    LOG("Connecting (SYN) ...");
-    while (!established) {
-        uint64_t t = now_ms();
-        if (t - syn_last >= (uint64_t)RDT_HANDSHAKE_RTO_MS) {
-            if (syn_retx++ > RDT_MAX_RETX) die("handshake failed (too many retries)");
-            RdtHeader syn{};
-            syn.seq = isn_send;
-            syn.ack = 0;
-            syn.flags = F_SYN;
-            syn.wnd = (uint16_t)fixed_wnd;
-            syn.len = 0;
-            syn.sack_mask = 0;
-            send_pkt(sock, peer, syn, nullptr);
-            syn_last = t;
-            LOG("TX SYN(seq=%u) retx=%d", isn_send, syn_retx - 1);
-        }
-
-        uint8_t buf[RDT_MAX_PKT];
-        sockaddr_in from{};
-        int fromlen = sizeof(from);
-        int n = recvfrom(sock, (char*)buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
-        if (n >= (int)sizeof(RdtHeader)) {
-            RdtHeader h{};
-            std::memcpy(&h, buf, sizeof(RdtHeader));
-            ntoh_header(h);
-
-            uint8_t* payload = buf + sizeof(RdtHeader);
-            if (!verify_checksum(h, payload)) { Sleep(1); continue; }
-
-            if ((h.flags & (F_SYN | F_ACK)) == (F_SYN | F_ACK) && h.ack == isn_send + 1) {
-                peer_isn = h.seq;
-
-                RdtHeader ack{};
-                ack.seq = isn_send + 1;
-                ack.ack = peer_isn + 1;
-                ack.flags = F_ACK;
-                ack.wnd = (uint16_t)fixed_wnd;
-                ack.len = 0;
-                ack.sack_mask = 0;
-                send_pkt(sock, peer, ack, nullptr);
-
-                established = true;
-                LOG("RX SYN|ACK(seq=%u, ack=%u) -> TX ACK(ack=%u). Connected.",
-                    peer_isn, h.ack, ack.ack);
-                break;
-            }
-        }
-        Sleep(1);
+    // Open input (read: whole file now; mmap: on demand as the window advances;
+    // stream: a reader thread keeps a few windows ahead; session: the same
+    // over the listed files)
+    FILE* fp = nullptr;
+    uint64_t window = (uint64_t)cfg.fixed_wnd * cfg.max_mss();
+    std::unique_ptr<InputSource> src;
+    SessionInput* sess = nullptr;
+    if (session) {
+        std::unique_ptr<SessionInput> in = open_session(in_file, window);
+        sess = in.get();
+        cfg.session = (int64_t)in->files().size();
+        LOG("Input: session of %zu files from %s, %llu bytes (manifest %llu bytes)", in->files().size(),
+            in_file.c_str(), (unsigned long long)in->size(), (unsigned long long)in->manifest_bytes());
+        src = std::move(in);
+    } else {
+        src = open_input(in_file, in_mode, window, &fp);
+        static const char* mode_names[] = {"read", "mmap", "stream"};
+        LOG("Input: %s (mode=%s)", in_file.c_str(), in_file == "-" ? "stream" : mode_names[in_mode]);
     }
 
-    // ====== Reno congestion control variables ======
-    int cwnd = 1;                 // in segments
-    int ssthresh = fixed_wnd;     // initial threshold
-    int dup_ack_cnt = 0;
-    uint32_t last_ack = base_ack;
-
-    // ====== CWND logging initialization ======
-    cwnd_log_init();
-    cwnd_log_record(cwnd);  // Record initial cwnd value
-
-    // ====== send buffer (sliding window) ======
-    std::map<uint32_t, OutSeg> out; // key=seq
-    size_t file_off = 0;
+    if (stripes == 1) {
+        cfg.trace_path = "rdt_trace.bin";
+        SendConnection conn(cfg, *src);
+        conn.run();
+        if (sess) session_report(*sess, conn.stats());
+        if (conn.stats().cookie != 0) cookie_save(cookie_file, cookie_key, conn.stats().cookie);
 
-    // ====== FIN state ======
-    bool fin_sent = false;
-    bool fin_acked = false;
-    uint64_t fin_last = 0;
-    int fin_retx = 0;
-
-    uint64_t start_ms = now_ms();
-
-    while (true) {
-        // effective window = min(fixed flow-control wnd, cwnd)
-        // inflight：当前在途未确认分片数
-        int inflight = 0;
-        for (auto& kv : out) if (!kv.second.acked) inflight++;
-
-        int eff_wnd = std::min(cwnd, fixed_wnd);
-
-        // ====== Fill window with DATA ======
-        while (inflight < eff_wnd && file_off < filedata.size()) {
-            uint16_t chunk = (uint16_t)std::min((size_t)RDT_MSS, filedata.size() - file_off);
-
-            OutSeg seg;
-            seg.seq = next_seq;
-            seg.len = chunk;
-            seg.data.assign(filedata.begin() + file_off, filedata.begin() + file_off + chunk);
-
-            RdtHeader dh{};
-            dh.seq = seg.seq;
-            dh.ack = 0;
-            dh.flags = F_DATA;
-            dh.wnd = (uint16_t)fixed_wnd;
-            dh.len = seg.len;
-            dh.sack_mask = 0;
-
-            send_pkt(sock, peer, dh, seg.data.data());
-            seg.last_sent_ms = now_ms();
-
-            out[seg.seq] = std::move(seg);
-
-            inflight++;
-            file_off += chunk;
-            next_seq += chunk;
-        }
-
-        // ====== Receive ACKs / FINs ======
-        uint8_t buf[RDT_MAX_PKT];
-        sockaddr_in from{};
-        int fromlen = sizeof(from);
-        int n = recvfrom(sock, (char*)buf, sizeof(buf), 0, (sockaddr*)&from, &fromlen);
-
-        if (n >= (int)sizeof(RdtHeader)) {
-            RdtHeader h{};
-            std::memcpy(&h, buf, sizeof(RdtHeader));
-            ntoh_header(h);
-
-            uint8_t* payload = buf + sizeof(RdtHeader);
-            if (!verify_checksum(h, payload)) goto after_recv;
-
-            // Peer FIN: ACK it and finish
-            if (h.flags & F_FIN) {
-                RdtHeader ack{};
-                ack.seq = next_seq + 1;
-                ack.ack = h.seq + 1;
-                ack.flags = F_ACK;
-                ack.wnd = (uint16_t)fixed_wnd;
-                ack.len = 0;
-                ack.sack_mask = 0;
-                send_pkt(sock, peer, ack, nullptr);
-                LOG("RX FIN(seq=%u) -> TX ACK(ack=%u). Done.", h.seq, ack.ack);
-                break;
-            }
-
-            if (h.flags & F_ACK) {
-                uint32_t ackno = h.ack;
-
-                // 1) new cumulative ACK
-                if (ackno > last_ack) {
-                    dup_ack_cnt = 0;
-
-                    // ====== Reno: Slow Start / Congestion Avoidance ======
-                    if (cwnd < ssthresh) {
-                        cwnd += 1; // slow start: cwnd += 1 per ACK (segment-granularity)
-                        cwnd_log_record(cwnd);  // Record cwnd change
-                        LOG("ACK advance to %u, slow start cwnd=%d ssthresh=%d", ackno, cwnd, ssthresh);
-                    } else {
-                        // congestion avoidance: cwnd += 1/cwnd per ACK (approx)
-                        static double ca_acc = 0.0;
-                        ca_acc += 1.0 / cwnd;
-                        if (ca_acc >= 1.0) {
-                            cwnd += 1;
-                            ca_acc -= 1.0;
-                            cwnd_log_record(cwnd);  // Record cwnd change
-                        }
-                        LOG("ACK advance to %u, cong avoid cwnd=%d ssthresh=%d", ackno, cwnd, ssthresh);
-                    }
-
-                    // 累计ACK：所有 (seq+len)<=ackno 的段 acked=true
-                    for (auto& kv : out) {
-                        auto& seg = kv.second;
-                        if (!seg.acked && (seg.seq + seg.len) <= ackno) seg.acked = true;
-                    }
-
-                    // SACK 标记：mark_sack_acked(ackno, h.sack_mask)
-                    mark_sack_acked(ackno, h.sack_mask, out);
-
-                    last_ack = ackno;
-                }
-                // 2) dupACK
-                else if (ackno == last_ack) {
-                    dup_ack_cnt++;
-                    if (dup_ack_cnt == 3) { // 快速重传
-                        // ====== Reno: Fast Retransmit + Fast Recovery ======
-                        uint32_t oldest = 0;
-                        bool found = false;
-                        for (auto& kv : out) {
-                            if (!kv.second.acked) { oldest = kv.first; found = true; break; }
-                        }
-                        if (found) {
-                            ssthresh = std::max(1, cwnd / 2);
-                            cwnd = ssthresh + 3;
-                            cwnd_log_record(cwnd);  // Record cwnd change (fast retransmit)
-
-                            auto& seg = out[oldest];
-                            RdtHeader dh{};
-                            dh.seq = seg.seq;
-                            dh.ack = 0;
-                            dh.flags = F_DATA;
-                            dh.wnd = (uint16_t)fixed_wnd;
-                            dh.len = seg.len;
-                            dh.sack_mask = 0;
-
-                            send_pkt(sock, peer, dh, seg.data.data());
-                            seg.last_sent_ms = now_ms();
-                            seg.retx++;
-
-                            LOG("3 dupACK -> Fast Retransmit seq=%u, cwnd=%d ssthresh=%d", seg.seq, cwnd, ssthresh);
-                        }
-                    } else if (dup_ack_cnt > 3) {
-                        cwnd += 1; // fast recovery inflate
-                        cwnd_log_record(cwnd);  // Record cwnd change (fast recovery)
-                        LOG("dupACK #%d -> fast recovery cwnd=%d", dup_ack_cnt, cwnd);
-                    }
-                }
-
-                // ====== Check if all data acked -> FIN ======
-                bool all_acked = (file_off >= filedata.size());
-                if (all_acked) {
-                    for (auto& kv : out) {
-                        if (!kv.second.acked) { all_acked = false; break; }
-                    }
-                }
-
-                if (all_acked && !fin_sent) {
-                    RdtHeader fin{};
-                    fin.seq = next_seq; // FIN consumes 1 seq number
-                    fin.ack = 0;
-                    fin.flags = F_FIN;
-                    fin.wnd = (uint16_t)fixed_wnd;
-                    fin.len = 0;
-                    fin.sack_mask = 0;
-                    send_pkt(sock, peer, fin, nullptr);
-
-                    fin_sent = true;
-                    fin_last = now_ms();
-                    LOG("TX FIN(seq=%u)", fin.seq);
-                }
-
-                if (fin_sent && (h.flags & F_ACK) && h.ack == next_seq + 1) {
-                    fin_acked = true;
-                    LOG("FIN ACKed (ack=%u). Waiting peer FIN...", h.ack);
-                }
+        // ====== CWND plot from the trace (outside the timed transfer) ======
+        if (plot) cwnd_plot_generate("rdt_trace.bin", "cwnd_curve.png");
+    } else {
+        // ====== Striped transfer: K connections, one range each ======
+        // Ranges are whole segments; the receiver writes each stripe at its
+        // offset. Each stripe has its own socket, cwnd and thread.
+        uint64_t size = src->size();
+        if (size == UINT64_MAX) die("--stripes needs a file input (not stdin)");
+        uint64_t segs = std::max<uint64_t>(1, (size + RDT_MSS - 1) / RDT_MSS);
+        stripes = (int)std::min<uint64_t>(stripes, segs);
+        uint64_t span = (segs + stripes - 1) / stripes * RDT_MSS;
+        uint32_t file_id = rdt_isn();
+        LOG("Striping %llu bytes over %d connections (file=%08x, %llu bytes each)",
+            (unsigned long long)size, stripes, file_id, (unsigned long long)span);
+
+        // stream mode: every stripe reads its own range on its own reader thread
+        std::vector<std::unique_ptr<InputSource>> ranges;
+        std::vector<FILE*> stripe_fps;
+        std::vector<std::unique_ptr<SendConnection>> conns;
+        for (int i = 0; i < stripes; i++) {
+            uint64_t begin = std::min(size, i * span);
+            uint64_t end = std::min(size, begin + span);
+            SenderConfig sc = cfg;
+            sc.client_port = cfg.client_port + i;
+            sc.trace_path = "rdt_trace_" + std::to_string(i) + ".bin";
+            sc.stripe.file = file_id;
+            sc.stripe.off = begin;
+            sc.stripe.idx = (uint8_t)i;
+            sc.stripe.cnt = (uint8_t)stripes;
+            if (in_mode == IN_STREAM) {
+                FILE* sfp = nullptr;
+                ranges.push_back(open_stream_range(in_file, window, begin, end, &sfp));
+                stripe_fps.push_back(sfp);
+            } else {
+                ranges.emplace_back(new RangeInput(*src, begin, end));
             }
+            conns.emplace_back(new SendConnection(sc, *ranges.back(), "[stripe " + std::to_string(i) + "]"));
         }
 
-    after_recv:
-        uint64_t t = now_ms();
-
-        // ====== Timeout retransmission (oldest unacked) ======
-        uint32_t oldest = 0;
-        bool found = false;
-        for (auto& kv : out) {
-            if (!kv.second.acked) { oldest = kv.first; found = true; break; }
+        uint64_t start_ms = now_ms();
+        std::vector<std::thread> threads;
+        for (auto& c : conns) threads.emplace_back(&SendConnection::run, c.get());
+        for (auto& th : threads) th.join();
+        double sec = (now_ms() - start_ms) / 1000.0;
+
+        // ====== Per-stripe and total statistics ======
+        SenderStats total;
+        for (int i = 0; i < stripes; i++) {
+            const SenderStats& s = conns[i]->stats();
+            LOG("Stripe %d: bytes=%llu time=%.3f s throughput=%.3f MB/s srtt=%.3f ms "
+                "fast recoveries=%llu timeouts=%llu retransmitted=%llu",
+                i, (unsigned long long)s.bytes, s.sec, s.mbps(), s.srtt_us / 1000.0,
+                (unsigned long long)s.fast_retx, (unsigned long long)s.rto_count,
+                (unsigned long long)s.retx_segs);
+            total.bytes += s.bytes;
+            total.fast_retx += s.fast_retx;
+            total.rto_count += s.rto_count;
+            total.retx_segs += s.retx_segs;
         }
-
-        if (found) {
-            auto& seg = out[oldest];
-            if (t - seg.last_sent_ms >= (uint64_t)RDT_RTO_MS) {
-                // ====== Reno reaction on timeout ======
-                ssthresh = std::max(1, cwnd / 2);
-                cwnd = 1;
-                dup_ack_cnt = 0;
-                cwnd_log_record(cwnd);  // Record cwnd change (timeout)
-
-                RdtHeader dh{};
-                dh.seq = seg.seq;
-                dh.ack = 0;
-                dh.flags = F_DATA;
-                dh.wnd = (uint16_t)fixed_wnd;
-                dh.len = seg.len;
-                dh.sack_mask = 0;
-
-                send_pkt(sock, peer, dh, seg.data.data());
-                seg.last_sent_ms = t;
-                seg.retx++;
-
-                LOG("TIMEOUT -> Retransmit seq=%u, cwnd=1 ssthresh=%d retx=%d",
-                    seg.seq, ssthresh, seg.retx);
-
-                if (seg.retx > RDT_MAX_RETX) die("too many retransmissions");
-            }
+        total.sec = sec;
+        LOG("Striped transfer done. stripes=%d bytes=%llu time=%.3f s, aggregate throughput=%.3f MB/s",
+            stripes, (unsigned long long)total.bytes, total.sec, total.mbps());
+        LOG("Striped loss recovery: %llu fast recoveries, %llu timeouts, %llu segments retransmitted",
+            (unsigned long long)total.fast_retx, (unsigned long long)total.rto_count,
+            (unsigned long long)total.retx_segs);
+
+        for (auto& c : conns) {
+            if (c->stats().cookie == 0) continue;
+            cookie_save(cookie_file, cookie_key, c->stats().cookie);
+            break;
         }
 
-        // ====== FIN retransmission (handshake-like) ======
-        if (fin_sent && !fin_acked) {
-            if (t - fin_last >= (uint64_t)RDT_HANDSHAKE_RTO_MS) {
-                if (fin_retx++ > RDT_MAX_RETX) die("FIN not acked (too many retries)");
-                RdtHeader fin{};
-                fin.seq = next_seq;
-                fin.ack = 0;
-                fin.flags = F_FIN;
-                fin.wnd = (uint16_t)fixed_wnd;
-                fin.len = 0;
-                fin.sack_mask = 0;
-                send_pkt(sock, peer, fin, nullptr);
-                fin_last = t;
-                LOG("RETX FIN(seq=%u) retx=%d", fin.seq, fin_retx);
-            }
-        }
+        conns.clear();
+        ranges.clear();
+        for (FILE* sfp : stripe_fps) std::fclose(sfp);
 
-        Sleep(1);
+        for (int i = 0; plot && i < stripes; i++) {
+            std::string n = std::to_string(i);
+            cwnd_plot_generate("rdt_trace_" + n + ".bin", "cwnd_curve_" + n + ".png");
+        }
     }
 
-    uint64_t end_ms = now_ms();
-    double sec = (end_ms - start_ms) / 1000.0;
-    double throughput = (filedata.size() / 1024.0 / 1024.0) / std::max(1e-9, sec);
-    LOG("Transfer done. time=%.3f s, avg throughput=%.3f MB/s", sec, throughput);
-
-    // ====== CWND logging: close and generate plot ======
-    cwnd_log_close();
-    cwnd_plot_generate();
-
-    closesocket(sock);
+    src.reset();
+    if (fp) std::fclose(fp);
     WSACleanup();
     return 0;
 }
@@ -0,0 +1,69 @@
+// Congestion-controller checks: an MSS change (path MTU probe) must leave
+// cwnd and ssthresh the same size in bytes, for every controller and in
+// every phase, so a larger segment never turns into a larger burst.
+//
+//   g++ -std=c++11 -O2 test_cc.cpp -o test_cc [-lws2_32]
+//   test_cc            (exit status 0: all checks passed)
+#include "rdt_cc.h"
+
+static int failures = 0;
+
+static void check_same(const char* what, const CongestionController& cc, double cwnd, double ssthresh) {
+    bool ok = std::fabs(cc.cwnd_bytes() - cwnd) <= 1e-6 * cwnd &&
+              std::fabs(cc.ssthresh_bytes() - ssthresh) <= 1e-6 * ssthresh;
+    std::printf("%-6s %-28s mss=%5d cwnd=%9.0f B (%3d segs) ssthresh=%9.0f B  %s\n", cc.name(), what,
+                cc.mss(), cc.cwnd_bytes(), cc.cwnd(), cc.ssthresh_bytes(), ok ? "ok" : "FAIL");
+    if (!ok) failures++;
+}
+
+// walk the MSS up as the prober does, then back down
+static void across_mss(const char* what, CongestionController& cc) {
+    static const int steps[] = {1452, 8952, 65231, 1000};
+    double cwnd = cc.cwnd_bytes(), ssthresh = cc.ssthresh_bytes();
+    for (int m : steps) {
+        cc.set_mss(m);
+        check_same(what, cc, cwnd, ssthresh);
+    }
+    if (cc.cwnd() < 1) {
+        std::printf("%s: cwnd() below one segment\n", cc.name());
+        failures++;
+    }
+}
+
+static void acks(CongestionController& cc, int n, uint64_t& now) {
+    for (int i = 0; i < n; i++) {
+        now += 1000;
+        cc.on_rtt_sample(10000, now);
+        AckEvent ev;
+        ev.acked = ev.delivered = (uint32_t)cc.mss();
+        ev.inflight = cc.cwnd();
+        ev.now_us = now;
+        cc.on_ack(ev);
+    }
+}
+
+int main() {
+    const CcAlgo algos[] = {CC_RENO, CC_CUBIC, CC_BBR};
+    for (CcAlgo a : algos) {
+        uint64_t now = 1000000;
+        std::unique_ptr<CongestionController> cc = make_cc(a, 64 * 1000, 1000);
+        across_mss("initial window", *cc);
+
+        cc = make_cc(a, 64 * 1000, 1000);
+        acks(*cc, 5, now);
+        across_mss("slow start", *cc);
+
+        cc = make_cc(a, 64 * 1000, 1000);
+        acks(*cc, 40, now);
+        cc->on_loss(now);
+        across_mss("fast recovery", *cc);
+        cc->on_recovery_exit();
+        acks(*cc, 100, now);
+        across_mss("after recovery", *cc);
+
+        cc->on_timeout(now);
+        across_mss("after timeout", *cc);
+    }
+    std::printf("%s\n", failures ? "FAILED" : "all checks passed");
+    return failures ? 1 : 0;
+}